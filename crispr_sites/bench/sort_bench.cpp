@@ -0,0 +1,123 @@
+// Benchmark radix_sort, on a vector and on a chunked_buffer, against
+// std::sort on guide codes.
+//
+// Usage:
+//
+//    cd bench && make
+//    ./sort_bench ../generated_files/untracked/hg38.fa [max_bases] [threads]
+//
+// The codes are produced by scan_for_kmers from an uncompressed FASTA file,
+// so they have the same distribution and the same (genome) order as the
+// codes scan_stdin sorts.  Without a file, a random sequence is scanned.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../chunked_buffer.hpp"
+#include "../crispr_sites.hpp"
+#include "../radix_sort.hpp"
+
+using namespace std;
+
+// forward declarations we need
+int scan_for_kmers(vector<int64_t>& results, const char* buf, size_t len);
+void init_encoding();
+
+constexpr int code_bits = 3 * (k - 3);
+
+double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void scan_sequence(vector<int64_t>& codes, string& sequence) {
+    scan_for_kmers(codes, sequence.data(), sequence.size());
+    sequence.clear();
+}
+
+void scan_fasta(vector<int64_t>& codes, const char* path, size_t max_bases) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "cannot open " << path << endl;
+        exit(1);
+    }
+    string line;
+    string sequence;
+    size_t bases = 0;
+    while (bases < max_bases && getline(in, line)) {
+        if (!line.empty() && line[0] == '>') {
+            scan_sequence(codes, sequence);
+            continue;
+        }
+        for (auto it = line.begin();  it != line.end();  ++it) {
+            char c = toupper(*it);
+            if (c != 'A' && c != 'C' && c != 'G' && c != 'T') {
+                c = 'N';
+            }
+            sequence.push_back(c);
+        }
+        bases += line.size();
+    }
+    scan_sequence(codes, sequence);
+}
+
+void scan_random(vector<int64_t>& codes, size_t num_bases) {
+    string sequence(num_bases, 'A');
+    srand(1);
+    for (auto it = sequence.begin();  it != sequence.end();  ++it) {
+        *it = "ACGT"[rand() % 4];
+    }
+    scan_sequence(codes, sequence);
+}
+
+int main(int argc, char** argv) {
+    init_encoding();
+
+    const size_t max_bases = argc > 2 ? strtoull(argv[2], nullptr, 10) : 200 * 1000 * 1000;
+    const int threads = argc > 3 ? atoi(argv[3]) : max(1u, thread::hardware_concurrency());
+
+    vector<int64_t> codes;
+    if (argc > 1) {
+        scan_fasta(codes, argv[1], max_bases);
+    } else {
+        cerr << "No FASTA file given, scanning a random sequence." << endl;
+        scan_random(codes, max_bases / 10);
+    }
+    cout << "Sorting " << codes.size() << " codes." << endl;
+
+    vector<int64_t> expected(codes);
+    auto start = chrono::steady_clock::now();
+    sort(expected.begin(), expected.end());
+    cout << "std::sort\t\t\t" << seconds_since(start) << " s" << endl;
+
+    for (int t = 1;  t <= threads;  t *= 2) {
+        vector<int64_t> v(codes);
+        start = chrono::steady_clock::now();
+        radix_sort(v, code_bits, t);
+        cout << "radix_sort, " << t << " threads\t\t" << seconds_since(start) << " s" << endl;
+        if (v != expected) {
+            cerr << "radix_sort result differs from std::sort" << endl;
+            return 1;
+        }
+        chunked_buffer<int64_t> chunks;
+        chunks.append(codes);
+        start = chrono::steady_clock::now();
+        radix_sort(chunks, code_bits, t);
+        cout << "radix_sort on chunks, " << t << " threads\t" << seconds_since(start) << " s" << endl;
+        chunks.move_to(v);
+        if (v != expected) {
+            cerr << "radix_sort on chunks differs from std::sort" << endl;
+            return 1;
+        }
+        if (t < threads && 2 * t > threads) {
+            t = threads / 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#ifndef CRISPR_SITES_CHUNKED_BUFFER_HPP
+#define CRISPR_SITES_CHUNKED_BUFFER_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+
+// Chunked append-only storage
+// ---------------------------
+//
+// A std::vector that grows by doubling briefly holds its old and its new
+// array while it copies, so appending billions of scan results needs up to
+// three times their size at the worst moment.  A chunked_buffer instead
+// appends into fixed-size chunks mapped one at a time, never copies what it
+// already holds, and can hand its contents over to a vector while releasing
+// each chunk as soon as it has been copied.  radix_sort.hpp sorts a
+// chunked_buffer in place the same way, releasing the chunks of each pass's
+// input as soon as they have been read.
+//
+// Chunks are anonymous mappings, so pages that are never written cost no
+// memory.  With huge_pages, each chunk is madvise()d for transparent huge
+// pages, which saves TLB misses on multi-gigabyte buffers.
+
+// Bytes per chunk, a multiple of the 2 MB huge page size.
+constexpr size_t CHUNK_BYTES = 32 * 1024 * 1024;
+
+
+template <typename T>
+class chunked_buffer {
+    static_assert(std::is_trivially_copyable<T>::value, "chunked_buffer copies with memcpy");
+
+public:
+    static constexpr size_t chunk_size = CHUNK_BYTES / sizeof(T);
+
+    explicit chunked_buffer(bool huge_pages = false) : huge_pages(huge_pages), count(0) {}
+
+    ~chunked_buffer() {
+        clear();
+    }
+
+    chunked_buffer(const chunked_buffer&) = delete;
+    chunked_buffer& operator=(const chunked_buffer&) = delete;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    T& operator[](size_t i) { return chunks[i / chunk_size][i % chunk_size]; }
+    const T& operator[](size_t i) const { return chunks[i / chunk_size][i % chunk_size]; }
+
+    void push_back(const T& x) {
+        if (count == chunks.size() * chunk_size) {
+            add_chunk();
+        }
+        chunks.back()[count % chunk_size] = x;
+        ++count;
+    }
+
+    // Append n copies of x.
+    void append(size_t n, const T& x) {
+        while (n > 0) {
+            if (count == chunks.size() * chunk_size) {
+                add_chunk();
+            }
+            const size_t m = std::min(n, chunk_size - count % chunk_size);
+            std::fill_n(chunks.back() + count % chunk_size, m, x);
+            count += m;
+            n -= m;
+        }
+    }
+
+    // Append data[0 ... n).
+    void append(const T* data, size_t n) {
+        while (n > 0) {
+            if (count == chunks.size() * chunk_size) {
+                add_chunk();
+            }
+            const size_t m = std::min(n, chunk_size - count % chunk_size);
+            memcpy(chunks.back() + count % chunk_size, data, m * sizeof(T));
+            count += m;
+            data += m;
+            n -= m;
+        }
+    }
+
+    void append(const std::vector<T>& v) {
+        append(v.data(), v.size());
+    }
+
+    // Append n records of zero bytes without writing them.  New chunks are
+    // fresh mappings, so their pages take up memory only once written.
+    void append_zeros(size_t n) {
+        count += n;
+        while (chunks.size() * chunk_size < count) {
+            add_chunk();
+        }
+    }
+
+    // The chunks in order.  Chunk c holds records [c * chunk_size, ...) and
+    // chunk_length(c) of them.
+    size_t num_chunks() const { return chunks.size(); }
+    T* chunk(size_t c) { return chunks[c]; }
+    const T* chunk(size_t c) const { return chunks[c]; }
+    size_t chunk_length(size_t c) const { return std::min(chunk_size, count - c * chunk_size); }
+
+    // Unmap chunk c ahead of the rest, once its records are no longer
+    // needed.  Only clear() or the destructor may follow, and
+    // different threads may release different chunks at once.
+    void release_chunk(size_t c) {
+        unmap(chunks[c]);
+        chunks[c] = nullptr;
+    }
+
+    // Copy everything to out, replacing its contents, and leave this
+    // buffer empty.  out only reserves its room up front, which touches no
+    // pages, and each chunk is released right after it is copied, so the
+    // two together hold about one chunk more than the contents.
+    void move_to(std::vector<T>& out) {
+        out.clear();
+        out.shrink_to_fit();
+        out.reserve(count);
+        for (size_t c = 0;  c < chunks.size();  ++c) {
+            out.insert(out.end(), chunks[c], chunks[c] + chunk_length(c));
+            release_chunk(c);
+        }
+        chunks.clear();
+        count = 0;
+    }
+
+    void swap(chunked_buffer& other) {
+        std::swap(huge_pages, other.huge_pages);
+        chunks.swap(other.chunks);
+        std::swap(count, other.count);
+    }
+
+    bool uses_huge_pages() const { return huge_pages; }
+
+    void clear() {
+        for (auto it = chunks.begin();  it != chunks.end();  ++it) {
+            unmap(*it);
+        }
+        chunks.clear();
+        count = 0;
+    }
+
+private:
+    void add_chunk() {
+        void* p = mmap(nullptr, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error(std::string("cannot allocate result chunk: ") + strerror(errno));
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages) {
+            // only a hint; without transparent huge pages this fails harmlessly
+            madvise(p, CHUNK_BYTES, MADV_HUGEPAGE);
+        }
+#endif
+        chunks.push_back(static_cast<T*>(p));
+    }
+
+    static void unmap(T* chunk) {
+        if (chunk) {
+            munmap(chunk, CHUNK_BYTES);
+        }
+    }
+
+    bool huge_pages;
+    std::vector<T*> chunks;
+    size_t count;
+};
+
+template <typename T>
+constexpr size_t chunked_buffer<T>::chunk_size;
+
+#endif
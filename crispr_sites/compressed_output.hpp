@@ -0,0 +1,201 @@
+#ifndef CRISPR_SITES_COMPRESSED_OUTPUT_HPP
+#define CRISPR_SITES_COMPRESSED_OUTPUT_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#ifdef CRISPR_SITES_ZSTD
+#include <zstd.h>
+#endif
+
+#include "crispr_sites.hpp"
+#include "output_writer.hpp"
+#include "pipeline.hpp"
+
+// Compressed output
+// -----------------
+//
+// With -z or -Z, each buffer-full of output becomes its own gzip member or
+// zstd frame.  Concatenated members and frames are a valid gzip or zstd
+// stream, which gzip -d, zcat and zstd -d read as one, so the blocks can be
+// compressed independently: a block_compressor hands them to worker
+// threads and writes the results in order, while the caller goes on
+// formatting the next block.
+//
+// zstd is available when crispr_sites is built with CRISPR_SITES_ZSTD (the
+// Makefile defines it when zstd.h is found).
+
+// zstd's usual default, spelled out because ZSTD_CLEVEL_DEFAULT is not in
+// the stable API of older zstd.h.  On guide lists, zstd -3 is more than
+// twice as fast as gzip -1, and level 1 saves no time worth its larger
+// output.
+constexpr int ZSTD_OUTPUT_LEVEL = 3;
+
+inline bool zstd_available() {
+#ifdef CRISPR_SITES_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+// Compress data[0 ... len) as one complete gzip member or zstd frame.
+inline std::vector<char> compress_block(output_compression kind, const char* data, size_t len) {
+    std::vector<char> out;
+    if (kind == output_compression::gzip) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // 15 + 16: a gzip header and trailer around the deflate stream.  The
+        // fastest level keeps compression from outlasting the scan; it is
+        // about 7 times faster than the default for 13% more output.
+        if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("cannot initialize gzip compression");
+        }
+        out.resize(deflateBound(&zs, len));
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = len;
+        zs.next_out = reinterpret_cast<Bytef*>(out.data());
+        zs.avail_out = out.size();
+        const int status = deflate(&zs, Z_FINISH);
+        out.resize(out.size() - zs.avail_out);
+        deflateEnd(&zs);
+        if (status != Z_STREAM_END) {
+            throw std::runtime_error("gzip compression failed");
+        }
+        return out;
+    }
+#ifdef CRISPR_SITES_ZSTD
+    if (kind == output_compression::zstd) {
+        out.resize(ZSTD_compressBound(len));
+        const size_t size = ZSTD_compress(out.data(), out.size(), data, len, ZSTD_OUTPUT_LEVEL);
+        if (ZSTD_isError(size)) {
+            throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(size));
+        }
+        out.resize(size);
+        return out;
+    }
+#endif
+    throw std::runtime_error("this crispr_sites was built without zstd");
+}
+
+
+class block_compressor {
+public:
+    block_compressor(int fd, output_compression kind, int num_threads)
+        : fd(fd), kind(kind), slots(2 * std::max(1, num_threads)), work(slots.size() + 1),
+          next_block(0), next_write(0) {
+        for (int t = 0;  t < std::max(1, num_threads);  ++t) {
+            workers.push_back(std::thread(&block_compressor::compress_blocks, this));
+        }
+    }
+
+    ~block_compressor() {
+        stop_workers();
+    }
+
+    block_compressor(const block_compressor&) = delete;
+    block_compressor& operator=(const block_compressor&) = delete;
+
+    // Queue a copy of data[0 ... len) as the next block.
+    void write(const char* data, size_t len) {
+        if (len == 0) {
+            return;
+        }
+        // the slot's previous block must be written out first
+        if (next_block - next_write == slots.size()) {
+            write_oldest();
+        }
+        slot& s = slots[next_block % slots.size()];
+        s.input.assign(data, data + len);
+        s.done = false;
+        work.push(next_block % slots.size());
+        ++next_block;
+    }
+
+    // Write all queued blocks.  An output without any blocks still gets
+    // one empty member or frame, so that it is valid compressed data.
+    void finish() {
+        if (next_block == 0) {
+            const std::vector<char> empty = compress_block(kind, "", 0);
+            write_fully(fd, empty.data(), empty.size());
+        }
+        while (next_write < next_block) {
+            write_oldest();
+        }
+        stop_workers();
+    }
+
+private:
+    struct slot {
+        std::vector<char> input;
+        std::vector<char> output;
+        std::string error;
+        bool done = true;
+    };
+
+    // Wait for the oldest queued block, and write it.
+    void write_oldest() {
+        slot& s = slots[next_write % slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            compressed.wait(lock, [&s]() { return s.done; });
+        }
+        if (!s.error.empty()) {
+            throw std::runtime_error(s.error);
+        }
+        write_fully(fd, s.output.data(), s.output.size());
+        ++next_write;
+    }
+
+    void compress_blocks() {
+        while (true) {
+            const size_t index = work.pop();
+            if (index == slots.size()) {
+                return;
+            }
+            slot& s = slots[index];
+            std::vector<char> output;
+            std::string error;
+            try {
+                output = compress_block(kind, s.input.data(), s.input.size());
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            s.output.swap(output);
+            s.error = error;
+            s.done = true;
+            compressed.notify_all();
+        }
+    }
+
+    void stop_workers() {
+        for (size_t t = 0;  t < workers.size();  ++t) {
+            work.push(slots.size());
+        }
+        for (auto it = workers.begin();  it != workers.end();  ++it) {
+            it->join();
+        }
+        workers.clear();
+    }
+
+    const int fd;
+    const output_compression kind;
+    std::vector<slot> slots;
+    bounded_queue<size_t> work;     // slot indexes to compress; slots.size() stops a worker
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable compressed;
+    uint64_t next_block;            // blocks queued so far
+    uint64_t next_write;            // blocks written so far
+};
+
+#endif
@@ -7,14 +7,37 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <vector>
-#include <set>
 #include <algorithm>
 #include <chrono>
 #include <numeric>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <exception>
 using namespace std;
 
 #include "crispr_sites.hpp"
+#include "chunked_buffer.hpp"
+#include "compressed_output.hpp"
+#include "delta_guide_file.hpp"
+#include "elias_fano.hpp"
+#include "fuse_filter.hpp"
+#include "guide_file.hpp"
+#include "gzip_input.hpp"
+#include "mapped_file.hpp"
+#include "mapped_output.hpp"
+#include "normalize_kernels.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+#include "output_writer.hpp"
+#include "radix_sort.hpp"
+#include "read_postings.hpp"
+#include "sorted_runs.hpp"
+#include "spill_runs.hpp"
+#include "wildcard_guides.hpp"
 
 // This program scans its input for forward k-3 mers ending with GG,
 // or reverse k-3 mers ending with CC.   It filters out guides that
@@ -27,7 +50,7 @@ using namespace std;
 //
 // Takes about 2 minutes on 2017 MacBook Pro.
 
-// Permit at most this many N characters per 23-mer.
+// Permit at most max_N N characters per 23-mer.
 //
 // For example, 'ACATAGTGACGTTNAAACATNG' is permitted because the trailing TNG
 // matches TGG which is a valid PAM for CRISPR.
@@ -38,7 +61,7 @@ using namespace std;
 // for the human genome hg38.fa.   Values much greater than 5 should be avoided,
 // as may result in signifficant explosion of output size.
 //
-constexpr int max_N = 2;
+// max_N is set with -n, up to max_max_N, and defaults to default_max_N.
 
 // Turn off expand_N_variants if you wish to see actual N characters in the output.
 // For the default "true", each N will be expanded into all possible variants.
@@ -56,12 +79,15 @@ constexpr int max_N = 2;
 //
 // This expansion permits the downstream pipeline not to need handling of N wildcards.
 //
-constexpr bool expand_N_variants = true;
+// -x turns it off.
+//
+// scan_for_kmers is instantiated for every combination of max_N and
+// expand_N_variants, so that both are compile-time constants in its inner
+// loop, and set_N_policy picks the instantiation once at startup.
 
 
 // A 20-mer over the ACGTN alphabet is representable by a 60 bit integer,
-// with each base letter represented by 3 consecutive bits.
-constexpr int bits_per_base = 3;
+// with each base letter represented by bits_per_base = 3 consecutive bits.
 constexpr int64_t lsb = 1;
 constexpr int64_t base_mask = (lsb << bits_per_base) - lsb;
 
@@ -75,20 +101,8 @@ constexpr int64_t fcm(int len) {
 // This runs at compile time.
 constexpr int64_t complement_mask = fcm(k - 3);
 
-// function to return sorted indices, to sort parallel arrays, taken from
-// https://stackoverflow.com/questions/1577475/c-sorting-and-keeping-track-of-indexes
-template <typename T>
-vector<size_t> sort_indexes(const vector<T> &v) {
-  // initialize original index locations
-  vector<size_t> idx(v.size());
-  iota(idx.begin(), idx.end(), 0);
-
-  // sort indexes based on comparing values in v
-  sort(idx.begin(), idx.end(),
-       [&v](size_t i1, size_t i2) {return v[i1] < v[i2];});
-
-  return idx;
-}
+// Codes of 20-mers use this many low bits, and radix sorting can skip the rest.
+constexpr int code_bits = bits_per_base * (k - 3);
 
 
 int64_t bitcode_for_base(const char c) {
@@ -129,15 +143,64 @@ char base_for_bitcode(const int64_t single_base_code) {
 }
 
 
+// scan_for_kmers assembles guide codes from bit planes (see below) with
+// these: spread_bits[x] puts bit j of the 10-bit x at bit bits_per_base * j,
+// and spread_bits_reversed[x] puts it at bit bits_per_base * (9 - j).
+constexpr int SPREAD_BITS = (k - 3) / 2;
+uint32_t spread_bits[1 << SPREAD_BITS];
+uint32_t spread_bits_reversed[1 << SPREAD_BITS];
+
+void init_spread_bits() {
+    static_assert(2 * SPREAD_BITS == k - 3, "guides are assembled from two halves");
+    for (uint32_t x = 0;  x < (1 << SPREAD_BITS);  ++x) {
+        spread_bits[x] = 0;
+        spread_bits_reversed[x] = 0;
+        for (int j = 0;  j < SPREAD_BITS;  ++j) {
+            if (x & (1 << j)) {
+                spread_bits[x] |= 1 << (bits_per_base * j);
+                spread_bits_reversed[x] |= 1 << (bits_per_base * (SPREAD_BITS - 1 - j));
+            }
+        }
+    }
+}
+
+
 // This optimization reduces runtime for hg38.fa from 2m20sec to just 2m.
 // But don't forget to run init_encoding.
 int encoding[1 << (sizeof(char) * 8)];
+//
+// Likewise, output decodes two bases at a time from base_pairs, and -P
+// converts two bases at a time between 3-bit and 2-bit codes.
+char base_pairs[1 << (2 * bits_per_base)][2];
+uint8_t packed_pairs[1 << (2 * bits_per_base)];
+uint8_t unpacked_pairs[1 << 4];
 void init_encoding() {
     encoding['A'] = bitcode_for_base('A');
     encoding['C'] = bitcode_for_base('C');
     encoding['N'] = bitcode_for_base('N');
     encoding['G'] = bitcode_for_base('G');
     encoding['T'] = bitcode_for_base('T');
+
+    const char* bases = "ACNGT";
+    for (int i = 0;  i < 5;  ++i) {
+        for (int j = 0;  j < 5;  ++j) {
+            const int pair_code = (encoding[(unsigned char) bases[i]] << bits_per_base) | encoding[(unsigned char) bases[j]];
+            base_pairs[pair_code][0] = bases[i];
+            base_pairs[pair_code][1] = bases[j];
+        }
+    }
+
+    // A, C, G, T are 0 to 3 in 2-bit codes
+    const char* acgt = "ACGT";
+    for (int i = 0;  i < 4;  ++i) {
+        for (int j = 0;  j < 4;  ++j) {
+            const int pair_code = (encoding[(unsigned char) acgt[i]] << bits_per_base) | encoding[(unsigned char) acgt[j]];
+            packed_pairs[pair_code] = (i << 2) | j;
+            unpacked_pairs[(i << 2) | j] = pair_code;
+        }
+    }
+
+    init_spread_bits();
 }
 
 
@@ -151,6 +214,9 @@ int64_t encode(const char* buf) {
     return code;
 }
 
+// the unit tests link against this instantiation
+template int64_t encode<k - 3>(const char* buf);
+
 
 void decode(char* buf, const int len, const int64_t code) {
     for (int i=0;  i < len;  ++i) {
@@ -160,6 +226,43 @@ void decode(char* buf, const int len, const int64_t code) {
 }
 
 
+// Same as decode(buf, k - 3, code), by table lookup.
+void decode_guide(char* buf, int64_t code) {
+    static_assert((k - 3) % 2 == 0, "decode_guide decodes pairs of bases");
+    constexpr int pair_mask = (1 << (2 * bits_per_base)) - 1;
+    for (int i = (k - 3) / 2 - 1;  i >= 0;  --i) {
+        buf[2 * i] = base_pairs[code & pair_mask][0];
+        buf[2 * i + 1] = base_pairs[code & pair_mask][1];
+        code >>= 2 * bits_per_base;
+    }
+}
+
+
+// The 2-bit code of a guide code without N: two bits per base, A, C, G, T
+// as 0 to 3, first base in the most significant bits.  Since the bases
+// keep their order, 2-bit codes sort like the guide codes they stand for.
+uint64_t pack_guide(int64_t code) {
+    constexpr int pair_mask = (1 << (2 * bits_per_base)) - 1;
+    uint64_t packed = 0;
+    for (int i = 0;  i < (k - 3) / 2;  ++i) {
+        packed |= uint64_t(packed_pairs[code & pair_mask]) << (4 * i);
+        code >>= 2 * bits_per_base;
+    }
+    return packed;
+}
+
+
+// The guide code of a 2-bit code.
+int64_t unpack_guide(uint64_t packed) {
+    int64_t code = 0;
+    for (int i = 0;  i < (k - 3) / 2;  ++i) {
+        code |= int64_t(unpacked_pairs[packed & 15]) << (2 * bits_per_base * i);
+        packed >>= 4;
+    }
+    return code;
+}
+
+
 int64_t complement(const int64_t code) {
     return complement_mask - code;
 }
@@ -204,13 +307,54 @@ void emit_all_variants(vector<int64_t>& results, const char* guide, const int nu
 }
 
 
+// The same variants as emit_all_variants, in the same order, computed from
+// the guide's code: code is what emit<direction> would push for the guide
+// with its N bases left in, and each variant overwrites the N digits of
+// code.  Complementing leaves N as N, so the N digits are found the same
+// way in both directions, and the reverse complement direction just writes
+// complemented digits.
+template <bool direction, int max_N>
+void emit_all_variant_codes(vector<int64_t>& results, const int64_t code, const int num_N_to_expand) {
+    // A, C, G, T, or their complements T, G, C, A
+    constexpr int64_t forward_digits[] = {1, 2, 4, 5};
+    constexpr int64_t complement_digits[] = {5, 4, 2, 1};
+    const int64_t* digits = (direction == forward_direction) ? forward_digits : complement_digits;
+
+    // the lowest bit of every digit equal to N (0b011)
+    constexpr int64_t digit_lsbs = complement_mask / 6;
+    int64_t N_lsbs = code & (code >> 1) & ~(code >> 2) & digit_lsbs;
+
+    // emit_all_variants counts in base 4 with the last N as its lowest
+    // digit, which is the N with the lowest shift
+    int shifts[max_N > 0 ? max_N : 1];
+    int num_N = 0;
+    int64_t cleared = code;
+    for (;  N_lsbs;  N_lsbs &= N_lsbs - 1) {
+        assert(num_N < num_N_to_expand);
+        shifts[num_N] = __builtin_ctzll(N_lsbs);
+        cleared &= ~(base_mask << shifts[num_N]);
+        ++num_N;
+    }
+    assert(num_N == num_N_to_expand);
+
+    const int number_variants = (1 << (2 * num_N));  // 4 power num_N
+    for (int n_code = 0;  n_code < number_variants;  ++n_code) {
+        int64_t variant = cleared;
+        for (int i = 0;  i < num_N;  ++i) {
+            variant |= digits[(n_code >> (i * 2)) & 0x3] << shifts[i];
+        }
+        results.push_back(variant);
+    }
+}
+
+
 template <bool direction>
 int index(const int j) {
     return (direction == forward_direction) ? j : k - 1 - j;
 }
 
 
-template <bool direction, char cog>
+template <bool direction, char cog, int max_N, bool expand_N_variants>
 void try_match(vector<int64_t>& results, const char* bufi) {
     char guide[k - 3];  // not 0 terminated
     int count[1 << (sizeof(char) * 8)];
@@ -242,7 +386,10 @@ void try_match(vector<int64_t>& results, const char* bufi) {
 }
 
 
-int scan_for_kmers(vector<int64_t>& results, const char* buf, size_t len) {
+// Scan every k-mer on its own with try_match.  This is the reference for
+// scan_for_kmers below, which must produce exactly the same results.
+template <int max_N, bool expand_N_variants>
+int scan_for_kmers_by_window(vector<int64_t>& results, const char* buf, size_t len) {
     assert(k <= 24);
 
     if (len < k) {
@@ -253,446 +400,2264 @@ int scan_for_kmers(vector<int64_t>& results, const char* buf, size_t len) {
     
     for (int i = 0;  i <= len - k;  ++i) {
         // match ...GG, or ...GN, or ...NG, or ...NN
-        try_match<forward_direction, 'G'>(results, buf + i);
+        try_match<forward_direction, 'G', max_N, expand_N_variants>(results, buf + i);
         // match CC..., or CN..., or NC..., or NN...
-        try_match<reverse_complement, 'C'>(results, buf + i);
+        try_match<reverse_complement, 'C', max_N, expand_N_variants>(results, buf + i);
     }
 
     return results.size() - num_results;
 }
 
 
-// Return number of milliseconds elapsed since Jan 1, 1970 00:00 GMT.
-long unixtime() {
-    using namespace chrono;
-    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+// Bit planes
+// ----------
+//
+// scan_for_kmers looks at 64 bases at a time through bit planes: bit j of
+// word w of a plane describes base 64 * w + j of the sequence.  Planes 0, 1
+// and 2 hold the three bits of each base's code, from which
+//
+//    N        = plane 0 & plane 1       (N is the only code with 0b011)
+//    C or N   = plane 1
+//    G or N   = plane 2 & ~plane 0 | N
+//
+// A PAM test for 64 k-mers is then a couple of shifts and ands, an N count
+// is a popcount, and a guide code is assembled from 20 bits of each plane
+// with the spread tables below.
+
+constexpr int NUM_PLANES = bits_per_base;
+
+// The bit planes of a sequence, plus two zero words so that 64 bits can
+// be read starting anywhere in the sequence.
+struct bit_planes {
+    vector<uint64_t> words[NUM_PLANES];
+    vector<uint64_t> N;
+    vector<uint64_t> GN;
+    vector<uint64_t> CN;
+
+    void build(const char* buf, size_t len) {
+        const size_t num_words = (len + 63) / 64 + 2;
+        for (int p = 0;  p < NUM_PLANES;  ++p) {
+            words[p].assign(num_words, 0);
+        }
+        N.assign(num_words, 0);
+        GN.assign(num_words, 0);
+        CN.assign(num_words, 0);
+        for (size_t w = 0;  w * 64 < len;  ++w) {
+            const char* b = buf + w * 64;
+            const int n = (int) min((size_t) 64, len - w * 64);
+            uint64_t p0 = 0, p1 = 0, p2 = 0;
+            for (int j = 0;  j < n;  ++j) {
+                const uint64_t e = encoding[(unsigned char) b[j]];
+                p0 |= (e & 1) << j;
+                p1 |= ((e >> 1) & 1) << j;
+                p2 |= ((e >> 2) & 1) << j;
+            }
+            words[0][w] = p0;
+            words[1][w] = p1;
+            words[2][w] = p2;
+            N[w] = p0 & p1;
+            GN[w] = (p2 & ~p0) | N[w];
+            CN[w] = p1;
+        }
+    }
+};
+
+
+// 64 bits of a plane, starting at base pos.
+inline uint64_t plane_bits(const vector<uint64_t>& plane, size_t pos) {
+    const size_t w = pos / 64;
+    const int s = pos % 64;
+    return s == 0 ? plane[w] : (plane[w] >> s) | (plane[w + 1] << (64 - s));
 }
 
-void scan_stdin(bool output_reads) {
-    init_encoding();
 
-    vector<int64_t> results;
+constexpr uint64_t guide_bits_mask = (uint64_t(1) << (k - 3)) - 1;
+constexpr uint32_t half_guide_mask = (1 << SPREAD_BITS) - 1;
 
-    // an array indexing which read a crispr site came from
-    vector<int64_t> sites_to_reads;
-    
-    // using c++ vector provides transparent memory management
-    vector<char> buffer(BUFFER_SIZE);
-    char* window = buffer.data();
 
-    // pairs of (separator_index, read_number)
-    vector<pair<int64_t, int64_t> > separator_indices;
-    
-    uintmax_t lines = 0;
-    uintmax_t bases = 0;
-    uintmax_t guides = 0;
+// The code of the guide at buf[pos ... pos + k - 3), as encode<k - 3> would
+// compute it.
+inline int64_t forward_code(const bit_planes& planes, size_t pos) {
+    int64_t code = 0;
+    for (int p = 0;  p < NUM_PLANES;  ++p) {
+        const uint64_t x = plane_bits(planes.words[p], pos);
+        const int64_t c = ((int64_t) spread_bits_reversed[x & half_guide_mask] << (bits_per_base * SPREAD_BITS))
+            | spread_bits_reversed[(x >> SPREAD_BITS) & half_guide_mask];
+        code |= c << p;
+    }
+    return code;
+}
 
-    // chromosome comments are lines that begin with '>'
-    // we filter those out
-    bool chrm_comment = false;
-    int overlap = 0;
-    auto t = unixtime();
-    auto t_last_print = t;
-    auto t_start = t;
 
-    int64_t current_read = 0;
+// The code of the reverse complement of buf[pos ... pos + k - 3).
+inline int64_t reverse_complement_code(const bit_planes& planes, size_t pos) {
+    int64_t code = 0;
+    for (int p = 0;  p < NUM_PLANES;  ++p) {
+        const uint64_t x = plane_bits(planes.words[p], pos);
+        const int64_t c = spread_bits[x & half_guide_mask]
+            | ((int64_t) spread_bits[(x >> SPREAD_BITS) & half_guide_mask] << (bits_per_base * SPREAD_BITS));
+        code |= c << p;
+    }
+    return complement(code);
+}
 
-    int num_ambiguous = 0;
-    
-    while (true) {
 
-        assert(0 <= overlap);
-        assert(overlap < k);
+// Scan for the same matches as scan_for_kmers_by_window, 64 k-mers at a
+// time.  For the k-mers starting at i ... i + 63,
+//
+//    forward PAM at i + 21, i + 22    GN bits at i + 21  &  GN bits at i + 22
+//    reverse PAM at i, i + 1          CN bits at i       &  CN bits at i + 1
+//
+// and only the k-mers with a PAM are visited, in order.  Guides with N
+// bases to expand have their variants computed from the guide's code.
+//
+// With wildcards, guides with N bases to expand are appended there as
+// wildcard guides instead (and not counted in the return value).
+template <int max_N, bool expand_N_variants>
+int scan_for_kmers_with(vector<int64_t>& results, vector<wildcard_guide>* wildcards, const char* buf, size_t len) {
+    assert(k <= 24);
+
+    if (len < k) {
+	return 0;
+    }
 
-        const ssize_t bytes_read = read(fileno(stdin), window + overlap, STRIDE_SIZE);
+    const int64_t num_results = results.size();
 
-        // end of file
-        if (bytes_read == 0) {
-            break;
+    // one set of planes per scanning thread, reused from call to call
+    static thread_local bit_planes planes;
+    planes.build(buf, len);
+
+    const size_t num_starts = len - k + 1;
+    for (size_t i = 0;  i < num_starts;  i += 64) {
+        uint64_t fwd_hits = plane_bits(planes.GN, i + k - 2) & plane_bits(planes.GN, i + k - 1);
+        uint64_t rc_hits = plane_bits(planes.CN, i) & plane_bits(planes.CN, i + 1);
+        if (num_starts - i < 64) {
+            const uint64_t valid = (uint64_t(1) << (num_starts - i)) - 1;
+            fwd_hits &= valid;
+            rc_hits &= valid;
         }
 
-        // Not sure when this happens.
-        if (bytes_read == (ssize_t) -1) {
-            throw runtime_error("ooops");
-        }
-
-        // Convert to uppercase and filter out chromosome comments.
-        int len = overlap;
-        for (int i = overlap;  i < bytes_read + overlap;  ++i) {
-            char c = toupper(window[i]);
-
-            if (c == '\n') {
-                ++lines;
-		if (chrm_comment) {
-		    separator_indices.push_back(make_pair(len, current_read + 1));
-		    current_read += 1;
-		}
-                chrm_comment = false;
-            } else if (!(chrm_comment)) {
-		assert(isprint(c));
-
-                if (c == '>') {
-                    chrm_comment = true;
-                } else {
-		    // Convert ambiguious characters to N
-		    if (c != 'A' && c != 'T' && c != 'G' && c != 'C' && c != 'N' && c != '-') {
-			c = 'N';
-			num_ambiguous++;
-		    }
-
-                    // ignore gap characters in sequence
-		    if (c != '-') {
-			window[len++] = c;
-		    }
+        for (uint64_t hits = fwd_hits | rc_hits;  hits;  hits &= hits - 1) {
+            const int j = __builtin_ctzll(hits);
+            const size_t pos = i + j;
+            if (fwd_hits & (uint64_t(1) << j)) {
+                // match ...GG, or ...GN, or ...NG, or ...NN
+                const int guide_N = __builtin_popcountll(plane_bits(planes.N, pos) & guide_bits_mask);
+                const int pam_N = __builtin_popcountll((plane_bits(planes.N, pos + k - 2)) & 3);
+                if (guide_N + pam_N <= max_N) {
+                    if (expand_N_variants && guide_N > 0) {
+                        if (wildcards) {
+                            wildcards->push_back(make_wildcard_guide(forward_code(planes, pos)));
+                        } else {
+                            emit_all_variant_codes<forward_direction, max_N>(results, forward_code(planes, pos), guide_N);
+                        }
+                    } else {
+                        results.push_back(forward_code(planes, pos));
+                    }
+                }
+            }
+            if (rc_hits & (uint64_t(1) << j)) {
+                // match CC..., or CN..., or NC..., or NN...
+                const int guide_N = __builtin_popcountll(plane_bits(planes.N, pos + 3) & guide_bits_mask);
+                const int pam_N = __builtin_popcountll(plane_bits(planes.N, pos) & 3);
+                if (guide_N + pam_N <= max_N) {
+                    if (expand_N_variants && guide_N > 0) {
+                        const int64_t code = reverse_complement_code(planes, pos + 3);
+                        if (wildcards) {
+                            wildcards->push_back(make_wildcard_guide(code));
+                        } else {
+                            emit_all_variant_codes<reverse_complement, max_N>(results, code, guide_N);
+                        }
+                    } else {
+                        results.push_back(reverse_complement_code(planes, pos + 3));
+                    }
                 }
             }
         }
-
-        bases += (len - overlap);
-
-	// How we scan_for_kmers
-	// ---------------------
-	// 
-	// Input is read from stdin into window. This buffer contains
-	// sequence stiched together from multiple lines/multiple
-	// chromosomes from the input FASTA file.
-	//
-	// We only wish to scan_for_kmers between input
-	// separators. separator_indices is a list of indices into
-	// window pointing to the start of the next segement we wish
-	// to scan
-	//
-	// We call scan_for_kmers on window start, separator_indices[0], then on each
-	// 
-	// seperator_indices[i], seperator_indices[i+1] for 0 <= i < seperator_indices.size() - 1
-	//
-	// for the last segment, we call scan_for_kmers on seperator_indices.back(), window.back()
-	//
-	// the code will then copy the last k - 1 entries from window
-	// to the beginning, to handle the case that window split a
-	// contiguous sequence we wish to scan.
-	//
-	// we reset separator_indices after scanning the window,
-	// unless seperator_indices.back() is closer than k - 1 from
-	// the end of window, then we clear and re-add the last
-	// separator.
-	
-        if (len < k) {
-            // There are no k-mers in the current buffer.
-            // This is likely the end of the file and the very last iteration.
-            overlap = len;
-        } else {
-            // window now starts with the last k-1 bases from the previous read,
-            // plus all bases from the current read
-
-            // overlap the last k-1 characters by moving them to the start of the window
-            overlap = k - 1;
-
-	    int num_crispr_sites_found = 0;
-	    
-	    if (separator_indices.size() == 0) {
-		// if not separators in this window, just scan it
-		num_crispr_sites_found = scan_for_kmers(results, window, len);
-		if (output_reads) {
-		    sites_to_reads.insert(sites_to_reads.end(), num_crispr_sites_found, current_read);
-		}
-	    } else {
-		// scan from the start of the window to the first separator
-		if (get<0>(separator_indices[0]) > 0) {
-		    num_crispr_sites_found = scan_for_kmers(results, window, get<0>(separator_indices[0]));
-		    if (output_reads) {
-			sites_to_reads.insert(sites_to_reads.end(),
-					      num_crispr_sites_found,
-					      get<1>(separator_indices[0]) - 1);
-		    }
-		}
-
-		// scan between each block of separators
-		for (auto it = separator_indices.begin(); it != --separator_indices.end(); it++) {
-		    num_crispr_sites_found = scan_for_kmers(results, window + get<0>(*it), get<0>(*next(it)) - get<0>(*it));
-		    if (output_reads) {
-			sites_to_reads.insert(sites_to_reads.end(),
-					      num_crispr_sites_found,
-					      get<1>(*it));
-		    }
-		}
-
-		// scan after the last separator, to the end of the window
- 		if (get<0>(separator_indices.back()) < len) {
-		    num_crispr_sites_found = scan_for_kmers(results, window + get<0>(separator_indices.back()), len - get<0>(separator_indices.back()));
-		    if (output_reads) {
-			sites_to_reads.insert(sites_to_reads.end(),
-					      num_crispr_sites_found,
-					      get<1>(separator_indices.back()));
-		    }
-		}
-
-		if (get<0>(separator_indices.back()) >= len - overlap) {
-		    // the last separator was in the overlap region,
-		    // so adjust the overlap to start with the separator
-
-		    overlap = len - get<0>(separator_indices.back());
-
-		    assert(overlap >= 0); // this shouldn't happen,
-   					  // separator_indices.back()
-					  // should be at most equal to
-					  // len
-
-		    int64_t last_read = get<1>(separator_indices.back());
-		    separator_indices.clear();
-		    separator_indices.push_back(make_pair(0, last_read));
-		} else {
-		    // otherwise we're done with this batch of
-		    // separators, so clear them out
-		    separator_indices.clear();
-		}
-	    }
-
-	    // move window over
-            for (int i=0;  i < overlap;  ++i) {
-                window[i] = window[len - overlap + i];
-            }
-        }
-
-        t = unixtime();
-        if (t - t_last_print > 10000) {
-            cerr << "Progress update "  << (t - t_start) / 1000 << " seconds after start." << endl;
-            cerr << "Lines so far: "  << lines  << endl;
-            cerr << "Bases so far: "  << bases  << endl;
-            cerr << endl;
-            t_last_print = t;
-        }
-
     }
 
-    // these are parallel arrays and should have the same size
-    if (output_reads) {
-	assert(results.size() == sites_to_reads.size());
-    }
-    
-    cerr << "Finished reading input."  << endl;
-    cerr << "Total lines: "  << lines  << endl;
-    cerr << "Total bases: "  << bases  << endl;
-    if (num_ambiguous > 0) {
-	cerr << "Converted " << num_ambiguous << " ambiguous bases to N" << endl;
-    }
-    
-    // If there are tons of duplicates, we may benefit from sorting each batch
-    // and then merging incrementally with c++ algorithm set_union,
-    // rather than doing a huge sort at the end.   Parallelizing, esp on GPU,
-    // could yield phenomenal speedup if we ever need to run this program fast.
-    cerr << "Sorting " << results.size() << " candidate guides." << endl;
+    return results.size() - num_results;
+}
 
-    vector<size_t> sorted_indices = sort_indexes(results);
-    
-    vector<set<int64_t> > unique_sites_to_reads;
 
-    int64_t last = 0;
-    
-    if (output_reads) {
-	for (int i = 0; i < results.size(); i++) {
-	    if (results[sorted_indices[i]] != last) {
-		set<int64_t> unique_reads;
-		unique_sites_to_reads.push_back(unique_reads);	    
-	    }
-	    unique_sites_to_reads.back().insert(sites_to_reads[sorted_indices[i]]);
-	    last = results[sorted_indices[i]];
-	}
+// Kernels for each N policy
+// -------------------------
 
+typedef int (*scan_kernel)(vector<int64_t>& results, vector<wildcard_guide>* wildcards, const char* buf, size_t len);
 
-	cerr << "Unique sites to reads: " << unique_sites_to_reads.size() << endl;
 
-	int max_reads = 0;
-	int max_read_idx = -1;
-	for (int i = 0; i < unique_sites_to_reads.size(); i++) {
-	    if (unique_sites_to_reads[i].size() > max_reads) {
-		max_reads = unique_sites_to_reads[i].size();
-		max_read_idx = sorted_indices[i];
-	    }
-	}
+template <int max_N, bool expand_N_variants>
+struct bitmask_kernel {
+    static int scan(vector<int64_t>& results, vector<wildcard_guide>* wildcards, const char* buf, size_t len) {
+        return scan_for_kmers_with<max_N, expand_N_variants>(results, wildcards, buf, len);
+    }
+};
+
 
-	cerr << "Guide " << max_read_idx << " had largest number of reads: " << max_reads << endl;
+template <int max_N, bool expand_N_variants>
+struct window_kernel {
+    static int scan(vector<int64_t>& results, vector<wildcard_guide>*, const char* buf, size_t len) {
+        return scan_for_kmers_by_window<max_N, expand_N_variants>(results, buf, len);
     }
-									 
-    // TODO: refactor these for loops so they all just use sorted indices
-    // Don't need to sort both indices and results in place, but for
-    // now keeps code complexity down
-    sort(results.begin(), results.end());
-    
-    // 0 is not a valid code
-    last = 0;
-    for (auto it = results.begin();  it != results.end();  ++it) {
-        if (*it != last) {
-            ++guides;
+};
+
+
+// Kernel<n, expand>::scan for a run time n in 0 ... max_N.
+template <template <int, bool> class Kernel, int max_N = max_max_N>
+struct kernel_selector {
+    static scan_kernel select(int n, bool expand) {
+        if (n == max_N) {
+            return expand ? Kernel<max_N, true>::scan : Kernel<max_N, false>::scan;
         }
-        last = *it;
+        return kernel_selector<Kernel, max_N - 1>::select(n, expand);
     }
+};
 
-    if (output_reads) {
-	assert(guides == unique_sites_to_reads.size());
+template <template <int, bool> class Kernel>
+struct kernel_selector<Kernel, -1> {
+    static scan_kernel select(int, bool) {
+        return nullptr;
     }
-    
-    cerr << "Outputting " << guides << " unique guides." << endl;
+};
 
-    char obuf[k-1];
-    obuf[k-2] = 0;
-    obuf[k-3] = 0;
 
-    if (output_reads) {
-        obuf[k-3] = '\t';
-    }
+// The kernel behind scan_for_kmers.
+scan_kernel active_scan_kernel = bitmask_kernel<default_max_N, default_expand_N_variants>::scan;
 
-    if (output_reads) {
-	cout << "Total reads: " << current_read << endl;
-    }
-    
-    int64_t i = 0;
-    for (auto it = results.begin();  it != results.end();  ++it) {
-        if (next(it) == results.end() || *next(it) != *it) {
-            decode(obuf, k-3, *it);
-            cout << obuf;
-            if (output_reads) {
-		for (auto it_reads = unique_sites_to_reads[i].begin(); it_reads != unique_sites_to_reads[i].end(); ++it_reads) {
-		    cout << *it_reads;
-		    if (next(it_reads) != unique_sites_to_reads[i].end()) {
-			cout << " ";
-		    }
-		}
-	    }
-	    cout << endl;
-	    ++i;
-        }
-    }
+
+// Make scan_for_kmers use max_N and expand_N_variants.  Not thread safe;
+// call before scanning.
+void set_N_policy(int max_N, bool expand_N_variants) {
+    assert(0 <= max_N && max_N <= max_max_N);
+    active_scan_kernel = kernel_selector<bitmask_kernel>::select(max_N, expand_N_variants);
 }
 
 
-void silent_tests() {
-    const char* kmer                = "ACGTGGTGGCAATGCACGGT";
-    const char* kmer_complement     = "TGCACCACCGTTACGTGCCA";
-    const char* kmer_2wc            = "ACGTGGTGGCAATNCACGGN";
-    const char* kmer_2wc_complement = "TGCACCACCGTTANGTGCCN";
-    const char* kmer_own_complement = "NNNNNNNNNNNNNNNNNNNN";
-    const char* nonse               = "abcdefghijklmnopqrst";
-    char buf[k-2];
-    assert(strlen(kmer) == k - 3);
-    assert(strlen(kmer_complement) == k - 3);
-    assert(strlen(kmer_2wc) == k - 3);
-    assert(strlen(kmer_2wc_complement) == k - 3);
-    assert(strlen(nonse) == k - 3);
-    assert(strlen(nonse) == sizeof(buf) - 1);
-    // ----------------
-    strcpy(buf, nonse);
-    assert(0 == strcmp(buf, nonse));
-    decode(buf, k-3, encode<k - 3>(kmer));
-    assert(0 == strcmp(buf, kmer));
-    // ----------------
-    strcpy(buf, nonse);
-    assert(0 == strcmp(buf, nonse));
-    decode(buf, k-3, complement(encode<k - 3>(kmer)));
-    assert(0 == strcmp(buf, kmer_complement));
-    // ----------------
-    strcpy(buf, nonse);
-    assert(0 == strcmp(buf, nonse));
-    decode(buf, k-3, complement(encode<k - 3>(kmer_complement)));
-    assert(0 == strcmp(buf, kmer));
-    // ----------------
-    strcpy(buf, nonse);
-    assert(0 == strcmp(buf, nonse));
-    decode(buf, k-3, encode<k - 3>(kmer_2wc));
-    assert(0 == strcmp(buf, kmer_2wc));
-    // ----------------
-    strcpy(buf, nonse);
-    assert(0 == strcmp(buf, nonse));
-    decode(buf, k-3, complement(encode<k - 3>(kmer_2wc)));
-    assert(0 == strcmp(buf, kmer_2wc_complement));
-    // ----------------
-    strcpy(buf, nonse);
-    assert(0 == strcmp(buf, nonse));
-    decode(buf, k-3, complement(encode<k - 3>(kmer_2wc_complement)));
-    assert(0 == strcmp(buf, kmer_2wc));
-    // ----------------
-    strcpy(buf, nonse);
-    assert(0 == strcmp(buf, nonse));
-    auto oc_code = encode<k - 3>(kmer_own_complement);
-    assert(oc_code == complement(oc_code));
-    // ----------------
-    vector<int64_t> expansions;
-    const char* expected[] = {
-        "ACGTGGTGGCAATACACGGA",
-        "ACGTGGTGGCAATACACGGC",
-        "ACGTGGTGGCAATACACGGG",
-        "ACGTGGTGGCAATACACGGT",
-        "ACGTGGTGGCAATCCACGGA",
-        "ACGTGGTGGCAATCCACGGC",
-        "ACGTGGTGGCAATCCACGGG",
-        "ACGTGGTGGCAATCCACGGT",
-        "ACGTGGTGGCAATGCACGGA",
-        "ACGTGGTGGCAATGCACGGC",
-        "ACGTGGTGGCAATGCACGGG",
-        "ACGTGGTGGCAATGCACGGT",
-        "ACGTGGTGGCAATTCACGGA",
-        "ACGTGGTGGCAATTCACGGC",
-        "ACGTGGTGGCAATTCACGGG",
-        "ACGTGGTGGCAATTCACGGT",
-    };
-    emit_all_variants<false>(expansions, kmer_2wc, 2);
-    for (int i=0; i<16; ++i) {
-        decode(buf, k - 3, expansions[i]);
-        assert(0 == strcmp(expected[i], buf));
-    }
-    if (false) {
-        // This is good but not silent.
-        for (auto it = expansions.begin();   it != expansions.end();   ++it) {
-            strcpy(buf, nonse);
-            assert(0 == strcmp(buf, nonse));
-            decode(buf, k - 3, *it);
-            cout << buf << endl;
-        }
-    }
+int scan_for_kmers(vector<int64_t>& results, vector<wildcard_guide>* wildcards, const char* buf, size_t len) {
+    return active_scan_kernel(results, wildcards, buf, len);
 }
 
-void print_usage(char* program_name) {
-    cerr << endl << "read a FASTA file from stdin and output crispr guide 20-mers to stdout, e.g.," << endl << endl;
-
-    cerr << "\t cat input.fa | " << program_name << " >! output.txt" << endl;
 
-    cerr << endl << "Optional command line arguments:" << endl << endl;
+int scan_for_kmers(vector<int64_t>& results, const char* buf, size_t len) {
+    return active_scan_kernel(results, nullptr, buf, len);
+}
 
-    cerr << program_name << " -[c|h]" << endl;
 
-    cerr << "\t -r \t Output the reads that each CRISPR site matches, use this for DASHit" << endl;
-    cerr << "\t -h \t Print this help" << endl;
+int scan_for_kmers_by_window(vector<int64_t>& results, const char* buf, size_t len,
+                             int max_N, bool expand_N_variants) {
+    assert(0 <= max_N && max_N <= max_max_N);
+    return kernel_selector<window_kernel>::select(max_N, expand_N_variants)(results, nullptr, buf, len);
 }
 
 
-// when compiling unit tests, the unit testing framework provides its own main()
-#ifndef UNIT_TESTS
-int main(int argc, char** argv) {
-    int opt;
+// A run of normalized sequence from a single read, with no separators inside.
+struct segment {
+    const char* buf;
+    size_t len;
+    int64_t read;
+};
 
-    bool output_reads = false;
 
-    cerr << PROGRAM_NAME << " " << PROGRAM_VERSION << endl;
-    
-    while ((opt = getopt(argc,argv,"rh")) != -1) {
-        switch (opt) {
-        case 'r':
-            output_reads = true;
-	    cerr << "Outputting read indices for DASHit use" << endl;
-            break;
-        case '?':
-        case 'h':
-            print_usage(argv[0]);
-            exit(0);
-            break;
-        }
-    }
+// Results of scanning part of a window.  Each scanning thread owns one, so
+// the threads never contend, and the buffers are concatenated in input order
+// afterwards.  The buffers are reused from window to window.
+struct scan_buffer {
+    vector<int64_t> results;
+    vector<int64_t> sites_to_reads;     // with -r
+    vector<wildcard_guide> wildcards;   // with -w
+};
+
+
+// A guide's 2-bit code in 5 bytes, for -P.
+constexpr int PACKED_GUIDE_BITS = 2 * (k - 3);
+
+struct packed_guide {
+    uint8_t bytes[PACKED_GUIDE_BITS / 8];
+};
+
+static_assert(sizeof(packed_guide) == PACKED_GUIDE_BITS / 8, "packed_guide must not be padded");
+
+
+// These move a 4-byte and a 1-byte piece, which compilers turn into two
+// plain loads or stores, where a 5-byte memcpy goes through the stack.
+static_assert(PACKED_GUIDE_BITS == 40, "packed guides are a 4-byte and a 1-byte piece");
+
+inline packed_guide make_packed_guide(uint64_t packed) {
+    packed_guide guide;
+    const uint32_t low = (uint32_t) packed;
+    memcpy(guide.bytes, &low, sizeof(low));
+    guide.bytes[4] = (uint8_t) (packed >> 32);
+    return guide;
+}
+
+
+inline uint64_t packed_value(const packed_guide& guide) {
+    uint32_t low;
+    memcpy(&low, guide.bytes, sizeof(low));
+    return low | (uint64_t(guide.bytes[4]) << 32);
+}
+
+
+// Everything the scan found, in input order.  results and sites_to_reads
+// are chunked, so they grow without reallocating (see chunked_buffer.hpp).
+struct scan_results {
+    explicit scan_results(bool huge_pages) : results(huge_pages), sites_to_reads(huge_pages) {}
+
+    chunked_buffer<int64_t> results;
+    chunked_buffer<int64_t> sites_to_reads;     // with -r
+    vector<wildcard_guide> wildcards;           // with -w
+
+    // with -P, the results are kept as packed_guides instead
+    bool packed = false;
+    chunked_buffer<packed_guide> packed_results;
+
+    // with -u, end_batch moves the results into sorted runs
+    bool deduplicate = false;
+    sorted_runs runs{code_bits};
+
+    // with -m, end_batch spills the results to run files in spill_dir once
+    // they take up half of spill_bytes, leaving the other half for sorting.
+    // end_batch runs between windows, so the results can pass that by what
+    // one window (or with -i, one round of -t pieces) finds.
+    uint64_t spill_bytes = 0;
+    string spill_dir;
+    bool spill_reads = false;   // runs of read_sites, for -r
+    uint32_t spill_flags = 0;
+    vector<unique_ptr<spill_run> > spilled;
+};
+
+
+// Take the -r results so far as one array of (code, read) records, sorted
+// by code and then read, with each read listed once per code.  The results
+// are in input order, so their reads never decrease, and a single stable
+// sort by code sorts the records by read within each code as well.
+vector<read_site> sorted_read_sites(scan_results& found, int num_threads) {
+    // the codes and reads are released chunk by chunk as they are paired up
+    chunked_buffer<read_site> pairs(found.results.uses_huge_pages());
+    for (size_t c = 0;  c < found.results.num_chunks();  ++c) {
+        const int64_t* codes = found.results.chunk(c);
+        const int64_t* reads = found.sites_to_reads.chunk(c);
+        for (size_t i = 0;  i < found.results.chunk_length(c);  ++i) {
+            pairs.push_back(read_site{codes[i], reads[i]});
+        }
+        found.results.release_chunk(c);
+        found.sites_to_reads.release_chunk(c);
+    }
+    found.results.clear();
+    found.sites_to_reads.clear();
+    radix_sort(pairs, [](const read_site& s) { return (uint64_t) s.code; }, code_bits, num_threads);
+    vector<read_site> sites;
+    pairs.move_to(sites);
+    sites.erase(unique(sites.begin(), sites.end()), sites.end());
+    return sites;
+}
+
+
+// Sort and deduplicate the results so far, and write them to a new run.
+void spill_results(scan_results& found, int num_threads) {
+    uint64_t records;
+    if (found.spill_reads) {
+        const vector<read_site> sites = sorted_read_sites(found, num_threads);
+        found.spilled.push_back(write_run(found.spill_dir, sites, found.spill_flags | GUIDE_FILE_READ_SITES));
+        records = sites.size();
+    } else {
+        radix_sort(found.results, code_bits, num_threads);
+        vector<int64_t> codes;
+        found.results.move_to(codes);
+        codes.erase(unique(codes.begin(), codes.end()), codes.end());
+        found.spilled.push_back(write_run(found.spill_dir, codes, found.spill_flags));
+        records = codes.size();
+    }
+    cerr << "Spilled run " << found.spilled.size() << " of " << records << " distinct records." << endl;
+}
+
+
+// Append everything in from to to, and clear from.
+void append_results(scan_results& to, scan_buffer& from) {
+    if (to.packed) {
+        for (auto it = from.results.begin();  it != from.results.end();  ++it) {
+            to.packed_results.push_back(make_packed_guide(pack_guide(*it)));
+        }
+    } else {
+        to.results.append(from.results);
+    }
+    to.sites_to_reads.append(from.sites_to_reads);
+    to.wildcards.insert(to.wildcards.end(), from.wildcards.begin(), from.wildcards.end());
+    from.results.clear();
+    from.sites_to_reads.clear();
+    from.wildcards.clear();
+}
+
+
+// With -m, spill the results if they have reached the budget, and with -u,
+// sort and deduplicate the results of the last batch into the runs.
+// Called between batches of about STRIDE_SIZE bytes of input.
+void end_batch(scan_results& found, int num_threads) {
+    const uint64_t held = (found.results.size() + found.sites_to_reads.size()) * sizeof(int64_t);
+    if (found.spill_bytes > 0 && 2 * held >= found.spill_bytes) {
+        spill_results(found, max(1, num_threads));
+    }
+    if (found.deduplicate) {
+        vector<int64_t> batch;
+        found.results.move_to(batch);
+        found.runs.add(batch, max(1, num_threads));
+    }
+}
+
+
+// Scan one segment into out.
+void scan_segment(scan_buffer& out, const segment& seg, const char* buf, size_t len,
+                  const scan_options& options) {
+    const int num_crispr_sites_found = scan_for_kmers(out.results, options.lazy_wildcards ? &out.wildcards : nullptr,
+                                                      buf, len);
+    if (options.output_reads) {
+        out.sites_to_reads.insert(out.sites_to_reads.end(), num_crispr_sites_found, seg.read);
+    }
+}
+
+
+// Number of k-mer start positions in a segment.
+size_t num_kmer_starts(const segment& seg) {
+    return seg.len < k ? 0 : seg.len - k + 1;
+}
+
+
+// Scan the k-mers whose start positions fall in [begin, end), where start
+// positions are numbered consecutively across all segments.  Each sub-range
+// reaches k - 1 characters past its last start position, so that neighbouring
+// sub-ranges overlap just like consecutive windows do.
+void scan_range(scan_buffer& out, const vector<segment>& segments,
+                size_t begin, size_t end, const scan_options& options) {
+    size_t offset = 0;
+    for (auto it = segments.begin();  it != segments.end() && offset < end;  ++it) {
+        const size_t starts = num_kmer_starts(*it);
+        const size_t lo = max(begin, offset);
+        const size_t hi = min(end, offset + starts);
+        if (lo < hi) {
+            scan_segment(out, *it, it->buf + (lo - offset), hi - lo + k - 1, options);
+        }
+        offset += starts;
+    }
+}
+
+
+// Below this many k-mer start positions, a window is not worth splitting
+// across threads.
+constexpr size_t MIN_STARTS_PER_THREAD = 64 * 1024;
+
+
+// Scan all segments of a window, appending to found in the same order a
+// single-threaded scan would produce.
+void scan_segments(scan_results& found, vector<scan_buffer>& buffers, const vector<segment>& segments,
+                   const scan_options& options) {
+    size_t total_starts = 0;
+    for (auto it = segments.begin();  it != segments.end();  ++it) {
+        total_starts += num_kmer_starts(*it);
+    }
+
+    const int num_threads = (int) min(buffers.size(), max((size_t) 1, total_starts / MIN_STARTS_PER_THREAD));
+
+    if (num_threads <= 1) {
+        for (auto it = segments.begin();  it != segments.end();  ++it) {
+            scan_segment(buffers[0], *it, it->buf, it->len, options);
+        }
+        append_results(found, buffers[0]);
+        return;
+    }
+
+    run_in_parallel(num_threads, [&](int t) {
+        scan_range(buffers[t], segments,
+                   block_start(total_starts, t, num_threads),
+                   block_start(total_starts, t + 1, num_threads),
+                   options);
+    });
+
+    for (int t = 0;  t < num_threads;  ++t) {
+        append_results(found, buffers[t]);
+    }
+}
+
+
+// Return number of milliseconds elapsed since Jan 1, 1970 00:00 GMT.
+long unixtime() {
+    using namespace chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+
+// Normalizer state carried from one chunk of input to the next.
+struct normalizer_state {
+    // chromosome comments are lines that begin with '>'
+    // we filter those out
+    bool chrm_comment = false;
+    int64_t current_read = 0;
+    uintmax_t lines = 0;
+    uintmax_t bases = 0;
+    uintmax_t num_ambiguous = 0;
+};
+
+
+// Convert src[0 ... n) to uppercase, filter out chromosome comments and gaps,
+// and append the remaining bases to window[len ...).  Returns the new len.
+// A separator is added for each chromosome comment, pointing at the
+// position in window where the sequence after the comment starts.
+//
+// Sequence goes through normalize_run (see normalize_kernels.hpp) a block
+// at a time, and comments are skipped with memchr.
+int normalize(const char* src, const size_t n, char* window, int len,
+              normalizer_state& state, vector<pair<int64_t, int64_t> >& separator_indices) {
+    size_t i = 0;
+    while (i < n) {
+        if (state.chrm_comment) {
+            const char* newline = static_cast<const char*>(memchr(src + i, '\n', n - i));
+            if (!newline) {
+                break;
+            }
+            i = newline - src + 1;
+            ++state.lines;
+            separator_indices.push_back(make_pair(len, state.current_read + 1));
+            state.current_read += 1;
+            state.chrm_comment = false;
+            continue;
+        }
+
+        const normalized_run run = normalize_run(src + i, n - i, window + len);
+        i += run.consumed;
+        len += run.written;
+        state.lines += run.newlines;
+        state.num_ambiguous += run.ambiguous;
+
+        if (i < n) {
+            // the run stopped at a comment or an unprintable character
+            const char c = toupper(src[i++]);
+	    assert(isprint(c));
+            if (c == '>') {
+                state.chrm_comment = true;
+            } else {
+                window[len++] = 'N';
+                state.num_ambiguous++;
+            }
+        }
+    }
+    return len;
+}
+
+
+// Split window[0 ... len) into the segments to scan, and return how many
+// characters at the end of the window must be carried over to the next one.
+//
+// How we scan_for_kmers
+// ---------------------
+//
+// Input is read from stdin into window. This buffer contains
+// sequence stiched together from multiple lines/multiple
+// chromosomes from the input FASTA file.
+//
+// We only wish to scan_for_kmers between input
+// separators. separator_indices is a list of indices into
+// window pointing to the start of the next segement we wish
+// to scan
+//
+// We call scan_for_kmers on window start, separator_indices[0], then on each
+//
+// seperator_indices[i], seperator_indices[i+1] for 0 <= i < seperator_indices.size() - 1
+//
+// for the last segment, we call scan_for_kmers on seperator_indices.back(), window.back()
+//
+// the code will then copy the last k - 1 entries from window
+// to the beginning of the next window, to handle the case that
+// window split a contiguous sequence we wish to scan.
+//
+// we reset separator_indices after scanning the window,
+// unless seperator_indices.back() is closer than k - 1 from
+// the end of window, then we clear and re-add the last
+// separator.
+//
+// The segments are collected first and scanned together by
+// scan_segments, which with -t splits them into overlapping
+// sub-ranges, one per thread.
+int cut_segments(const char* window, const int len, const int64_t current_read,
+                 vector<pair<int64_t, int64_t> >& separator_indices, vector<segment>& segments) {
+    assert(len >= k);
+
+    // window now starts with the last k-1 bases from the previous read,
+    // plus all bases from the current read
+
+    // overlap the last k-1 characters by moving them to the start of the window
+    int overlap = k - 1;
+
+    segments.clear();
+
+    if (separator_indices.size() == 0) {
+	// if not separators in this window, just scan it
+	segments.push_back(segment{window, (size_t) len, current_read});
+    } else {
+	// scan from the start of the window to the first separator
+	if (get<0>(separator_indices[0]) > 0) {
+	    segments.push_back(segment{window, (size_t) get<0>(separator_indices[0]),
+				       get<1>(separator_indices[0]) - 1});
+	}
+
+	// scan between each block of separators
+	for (auto it = separator_indices.begin(); it != --separator_indices.end(); it++) {
+	    segments.push_back(segment{window + get<0>(*it),
+				       (size_t) (get<0>(*next(it)) - get<0>(*it)),
+				       get<1>(*it)});
+	}
+
+	// scan after the last separator, to the end of the window
+	if (get<0>(separator_indices.back()) < len) {
+	    segments.push_back(segment{window + get<0>(separator_indices.back()),
+				       (size_t) (len - get<0>(separator_indices.back())),
+				       get<1>(separator_indices.back())});
+	}
+
+	if (get<0>(separator_indices.back()) >= len - overlap) {
+	    // the last separator was in the overlap region,
+	    // so adjust the overlap to start with the separator
+
+	    overlap = len - get<0>(separator_indices.back());
+
+	    assert(overlap >= 0); // this shouldn't happen,
+				  // separator_indices.back()
+				  // should be at most equal to
+				  // len
+
+	    int64_t last_read = get<1>(separator_indices.back());
+	    separator_indices.clear();
+	    separator_indices.push_back(make_pair(0, last_read));
+	} else {
+	    // otherwise we're done with this batch of
+	    // separators, so clear them out
+	    separator_indices.clear();
+	}
+    }
+
+    return overlap;
+}
+
+
+// The input pipeline
+// ------------------
+//
+// scan_stdin runs as three stages, each on its own thread, so that reading
+// the input, normalizing it and scanning it all overlap:
+//
+//    reader      reads raw chunks of up to STRIDE_SIZE bytes from stdin
+//    normalizer  normalizes each chunk into a window, after the characters
+//                carried over from the previous window, and cuts the window
+//                into segments
+//    scanner     (the calling thread) scans the segments of each window
+//
+// Stages hand buffers forward through one bounded_queue and get them back
+// through another, so PIPELINE_DEPTH buffers of each kind circulate and a
+// stage that runs ahead simply waits for a free buffer.
+//
+// gzip input gets a fourth stage between reader and normalizer: the reader
+// then reads compressed chunks, and an inflater turns them into raw chunks.
+// Plain gzip is inflated by that stage's thread as one stream.  BGZF is
+// cut into blocks, and the blocks of each raw chunk are inflated in
+// parallel by -t threads.
+constexpr int PIPELINE_DEPTH = 3;
+
+constexpr size_t COMPRESSED_CHUNK_SIZE = 4 * 1024 * 1024;
+
+
+// A chunk of raw (or compressed) input.  len is 0 at the end of input and
+// -1 after an error, which is described by error.
+struct raw_chunk {
+    char* data;
+    ssize_t len;
+    string error;
+};
+
+
+// A normalized window and its segments.  The last window of the input
+// carries no segments, just end_of_input (and the error that ended the
+// input early, if any).
+struct window_batch {
+    vector<char> buffer = vector<char>(BUFFER_SIZE);
+    vector<segment> segments;
+
+    // normalizer statistics, as of the end of this window
+    uintmax_t lines = 0;
+    uintmax_t bases = 0;
+
+    bool end_of_input = false;
+    string error;
+};
+
+
+// A ring of chunk buffers between two stages.
+struct chunk_ring {
+    bounded_queue<raw_chunk> full{PIPELINE_DEPTH};
+    bounded_queue<char*> free{PIPELINE_DEPTH};
+    vector<vector<char> > buffers;
+
+    explicit chunk_ring(size_t chunk_size) : buffers(PIPELINE_DEPTH, vector<char>(chunk_size)) {
+        for (int i = 0;  i < PIPELINE_DEPTH;  ++i) {
+            free.push(buffers[i].data());
+        }
+    }
+};
+
+
+struct input_pipeline {
+    chunk_ring chunks{STRIDE_SIZE};
+    bounded_queue<window_batch*> full_windows{PIPELINE_DEPTH};
+    bounded_queue<window_batch*> free_windows{PIPELINE_DEPTH};
+    vector<window_batch> windows;
+
+    // time spent inflating compressed input
+    atomic<uint64_t> inflate_micros{0};
+
+    input_pipeline() : windows(PIPELINE_DEPTH) {
+        for (int i = 0;  i < PIPELINE_DEPTH;  ++i) {
+            free_windows.push(&windows[i]);
+        }
+    }
+};
+
+
+// Read up to len bytes, fewer only at the end of input.
+ssize_t read_fully(int fd, char* buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        const ssize_t bytes_read = read(fd, buf + total, len - total);
+        if (bytes_read == 0) {
+            break;
+        }
+        if (bytes_read == (ssize_t) -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total += bytes_read;
+    }
+    return total;
+}
+
+
+// Fill chunks of chunk_size bytes from fd, starting with prefix, which
+// holds bytes already read from fd.
+void read_stage(chunk_ring& ring, size_t chunk_size, int fd, string prefix) {
+    while (true) {
+        char* data = ring.free.pop();
+        memcpy(data, prefix.data(), prefix.size());
+        ssize_t len = read_fully(fd, data + prefix.size(), chunk_size - prefix.size());
+        if (len >= 0) {
+            len += prefix.size();
+        }
+        prefix.clear();
+        ring.full.push(raw_chunk{data, len, len < 0 ? string("error reading input: ") + strerror(errno) : ""});
+        if (len <= 0) {
+            break;
+        }
+    }
+}
+
+
+uint64_t micros_since(chrono::steady_clock::time_point start) {
+    using namespace chrono;
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+
+// Inflate a plain gzip stream from the compressed ring into raw chunks.
+void inflate_stage(input_pipeline& pipeline, chunk_ring& compressed) {
+    gzip_inflater inflater;
+    char* out = pipeline.chunks.free.pop();
+    size_t out_len = 0;
+    string error;
+
+    while (true) {
+        const raw_chunk chunk = compressed.full.pop();
+        if (chunk.len <= 0) {
+            error = chunk.error;
+            if (error.empty()) {
+                try {
+                    inflater.finish();
+                } catch (const exception& e) {
+                    error = e.what();
+                }
+            }
+            break;
+        }
+        const char* in = chunk.data;
+        size_t in_len = chunk.len;
+        try {
+            while (in_len > 0) {
+                const auto start = chrono::steady_clock::now();
+                out_len += inflater.inflate_some(in, in_len, out + out_len, STRIDE_SIZE - out_len);
+                pipeline.inflate_micros += micros_since(start);
+                if (out_len == STRIDE_SIZE) {
+                    pipeline.chunks.full.push(raw_chunk{out, (ssize_t) out_len, ""});
+                    out = pipeline.chunks.free.pop();
+                    out_len = 0;
+                }
+            }
+        } catch (const exception& e) {
+            error = e.what();
+        }
+        compressed.free.push(chunk.data);
+        if (!error.empty()) {
+            // drain the reader, so that it can finish
+            for (raw_chunk rest = chunk;  rest.len > 0; ) {
+                rest = compressed.full.pop();
+                compressed.free.push(rest.data);
+            }
+            break;
+        }
+    }
+
+    if (out_len > 0 && error.empty()) {
+        pipeline.chunks.full.push(raw_chunk{out, (ssize_t) out_len, ""});
+        out = pipeline.chunks.free.pop();
+    }
+    pipeline.chunks.full.push(raw_chunk{out, error.empty() ? 0 : -1, error});
+}
+
+
+// A BGZF block within bgzf_stage's pending compressed bytes, and where its
+// inflated bytes go in the raw chunk.
+struct bgzf_block {
+    size_t offset;
+    size_t size;
+    size_t out_offset;
+};
+
+
+// Inflate BGZF blocks from the compressed ring into raw chunks, with the
+// blocks of each raw chunk inflated by num_threads threads in parallel.
+void bgzf_stage(input_pipeline& pipeline, chunk_ring& compressed, int num_threads) {
+    vector<char> pending;     // compressed bytes not yet inflated
+    size_t consumed = 0;      // of which this many belong to collected blocks
+    bool end_of_input = false;
+    string error;
+    vector<bgzf_block> blocks;
+    vector<unique_ptr<bgzf_inflater> > inflaters(num_threads);
+    for (auto it = inflaters.begin();  it != inflaters.end();  ++it) {
+        it->reset(new bgzf_inflater());
+    }
+
+    while (error.empty()) {
+        // Drop the blocks inflated last time, then collect the blocks that
+        // fit in one raw chunk.
+        pending.erase(pending.begin(), pending.begin() + consumed);
+        consumed = 0;
+        blocks.clear();
+        size_t out_len = 0;
+        while (true) {
+            const long size = bgzf_block_size(pending.data() + consumed, pending.size() - consumed);
+            if (size < 0) {
+                error = "input is not valid BGZF";
+                break;
+            }
+            if (size == 0 || (size_t) size > pending.size() - consumed) {
+                // not a whole block left, so get more input
+                if (end_of_input) {
+                    if (pending.size() > consumed) {
+                        error = "unexpected end of BGZF input";
+                    }
+                    break;
+                }
+                const raw_chunk chunk = compressed.full.pop();
+                if (chunk.len <= 0) {
+                    end_of_input = true;
+                    error = chunk.error;
+                    if (!error.empty()) {
+                        break;
+                    }
+                } else {
+                    pending.insert(pending.end(), chunk.data, chunk.data + chunk.len);
+                    compressed.free.push(chunk.data);
+                }
+                continue;
+            }
+            const size_t isize = bgzf_block_isize(pending.data() + consumed, size);
+            if (isize > BGZF_MAX_BLOCK_SIZE) {
+                error = "corrupt BGZF block in input";
+                break;
+            }
+            if (out_len + isize > STRIDE_SIZE) {
+                break;
+            }
+            blocks.push_back(bgzf_block{consumed, (size_t) size, out_len});
+            consumed += size;
+            out_len += isize;
+        }
+
+        if (!error.empty() || blocks.empty()) {
+            break;
+        }
+
+        char* out = pipeline.chunks.free.pop();
+        const auto start = chrono::steady_clock::now();
+        vector<string> errors(num_threads);
+        run_in_parallel(num_threads, [&](int t) {
+            try {
+                for (size_t i = t;  i < blocks.size();  i += num_threads) {
+                    inflaters[t]->inflate_block(pending.data() + blocks[i].offset, blocks[i].size,
+                                                out + blocks[i].out_offset);
+                }
+            } catch (const exception& e) {
+                errors[t] = e.what();
+            }
+        });
+        pipeline.inflate_micros += micros_since(start);
+        for (auto it = errors.begin();  it != errors.end();  ++it) {
+            if (!it->empty()) {
+                error = *it;
+            }
+        }
+        if (error.empty()) {
+            pipeline.chunks.full.push(raw_chunk{out, (ssize_t) out_len, ""});
+        } else {
+            pipeline.chunks.free.push(out);
+        }
+    }
+
+    // drain the reader, so that it can finish
+    while (!end_of_input) {
+        const raw_chunk chunk = compressed.full.pop();
+        end_of_input = chunk.len <= 0;
+        if (!end_of_input) {
+            compressed.free.push(chunk.data);
+        }
+    }
+
+    char* out = pipeline.chunks.free.pop();
+    pipeline.chunks.full.push(raw_chunk{out, error.empty() ? 0 : -1, error});
+}
+
+
+void normalize_stage(input_pipeline& pipeline, normalizer_state& state) {
+    // pairs of (separator_index, read_number)
+    vector<pair<int64_t, int64_t> > separator_indices;
+
+    window_batch* batch = pipeline.free_windows.pop();
+    int overlap = 0;
+
+    while (true) {
+        assert(0 <= overlap);
+        assert(overlap < k);
+
+        const raw_chunk chunk = pipeline.chunks.full.pop();
+        if (chunk.len <= 0) {
+            batch->segments.clear();
+            batch->end_of_input = true;
+            batch->error = chunk.error;
+            pipeline.full_windows.push(batch);
+            break;
+        }
+
+        char* window = batch->buffer.data();
+        const int len = normalize(chunk.data, chunk.len, window, overlap, state, separator_indices);
+        pipeline.chunks.free.push(chunk.data);
+
+        state.bases += (len - overlap);
+
+        if (len < k) {
+            // There are no k-mers in the current buffer.
+            // This is likely the end of the file and the very last iteration.
+            overlap = len;
+            continue;
+        }
+
+        overlap = cut_segments(window, len, state.current_read, separator_indices, batch->segments);
+        batch->lines = state.lines;
+        batch->bases = state.bases;
+
+        // move window over
+        window_batch* next_batch = pipeline.free_windows.pop();
+        memcpy(next_batch->buffer.data(), window + len - overlap, overlap);
+        pipeline.full_windows.push(batch);
+        batch = next_batch;
+    }
+}
+
+
+// Write each distinct code of the sorted codes as a line of text.
+// Lines are decoded straight into the output buffer, GUIDE_BATCH at a time.
+constexpr size_t GUIDE_BATCH = 4096;
+
+void write_guides(output_writer& out, const vector<int64_t>& codes) {
+    constexpr size_t line_length = k - 2;  // the guide and a newline
+    auto it = codes.begin();
+    while (it != codes.end()) {
+        char* const start = out.reserve(GUIDE_BATCH * line_length);
+        char* obuf = start;
+        for (size_t n = 0;  n < GUIDE_BATCH && it != codes.end();  ++it) {
+            if (next(it) == codes.end() || *next(it) != *it) {
+                decode_guide(obuf, *it);
+                obuf[k - 3] = '\n';
+                obuf += line_length;
+                ++n;
+            }
+        }
+        out.commit(obuf - start);
+    }
+}
+
+
+// Write the distinct codes of the sorted codes as a binary guide file.
+void write_guide_file(output_writer& out, const vector<int64_t>& codes, uint64_t count, uint32_t flags) {
+    const guide_file_header header = make_guide_file_header(k, bits_per_base, flags, count);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (auto it = codes.begin();  it != codes.end();  ++it) {
+        if (next(it) == codes.end() || *next(it) != *it) {
+            out.write(reinterpret_cast<const char*>(&*it), sizeof(int64_t));
+        }
+    }
+}
+
+
+// Write a delta guide file, in the order of its layout.
+void write_delta_guide_file(output_writer& out, delta_guide_encoder& encoder) {
+    const delta_file_header& header = encoder.header();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(encoder.index().data()), encoder.index().size() * sizeof(delta_block_index));
+    out.write(reinterpret_cast<const char*>(encoder.block_data().data()), encoder.block_data().size());
+}
+
+
+// Write an Elias-Fano guide file, in the order of its layout.
+void write_elias_fano_file(output_writer& out, elias_fano_builder& builder) {
+    builder.finish();
+    const elias_fano_header& header = builder.header();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const vector<uint64_t>* words : {&builder.low_words(), &builder.upper_words(),
+                                           &builder.ones_sample_words(), &builder.zeros_sample_words()}) {
+        out.write(reinterpret_cast<const char*>(words->data()), words->size() * sizeof(uint64_t));
+    }
+}
+
+
+// Write a binary fuse filter file, in the order of its layout.
+void write_fuse_filter_file(output_writer& out, fuse_filter_builder& builder) {
+    builder.finish();
+    const fuse_filter_header& header = builder.header();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(builder.shards().data()), builder.shards().size() * sizeof(fuse_filter_shard));
+    out.write(reinterpret_cast<const char*>(builder.fingerprint_bytes().data()), builder.fingerprint_bytes().size());
+}
+
+
+// Print progress to stderr, at most every 10 seconds.
+struct progress_reporter {
+    long t_start = unixtime();
+    long t_last_print = t_start;
+
+    // set when the input is compressed
+    const atomic<uint64_t>* inflate_micros = nullptr;
+
+    void update(uintmax_t lines, uintmax_t bases) {
+        const long t = unixtime();
+        if (t - t_last_print > 10000) {
+            cerr << "Progress update "  << (t - t_start) / 1000 << " seconds after start." << endl;
+            cerr << "Lines so far: "  << lines  << endl;
+            cerr << "Bases so far: "  << bases  << endl;
+            if (inflate_micros) {
+                cerr << "Decompression time so far: "  << *inflate_micros / 1000000 << " seconds" << endl;
+            }
+            cerr << endl;
+            t_last_print = t;
+        }
+    }
+};
+
+
+// Scan the FASTA input from fd through the input pipeline.  gzip and BGZF
+// input is recognized by its first bytes.
+void scan_stream(int fd, const scan_options& options, normalizer_state& state, scan_results& found) {
+    // one result buffer per scanning thread
+    vector<scan_buffer> buffers(max(1, options.num_threads));
+
+    progress_reporter progress;
+    input_pipeline pipeline;
+
+    // enough to recognize a BGZF header
+    string prefix(GZIP_HEADER_SIZE + 6, 0);
+    const ssize_t prefix_len = read_fully(fd, &prefix[0], prefix.size());
+    if (prefix_len < 0) {
+        throw runtime_error(string("error reading input: ") + strerror(errno));
+    }
+    prefix.resize(prefix_len);
+
+    unique_ptr<chunk_ring> compressed;
+    vector<thread> stages;
+
+    if (is_gzip(prefix.data(), prefix.size())) {
+        compressed.reset(new chunk_ring(COMPRESSED_CHUNK_SIZE));
+        stages.push_back(thread(read_stage, ref(*compressed), COMPRESSED_CHUNK_SIZE, fd, prefix));
+        if (bgzf_block_size(prefix.data(), prefix.size()) > 0) {
+            cerr << "Reading BGZF input" << endl;
+            stages.push_back(thread(bgzf_stage, ref(pipeline), ref(*compressed), max(1, options.num_threads)));
+        } else {
+            cerr << "Reading gzip input" << endl;
+            stages.push_back(thread(inflate_stage, ref(pipeline), ref(*compressed)));
+        }
+        progress.inflate_micros = &pipeline.inflate_micros;
+    } else {
+        stages.push_back(thread(read_stage, ref(pipeline.chunks), STRIDE_SIZE, fd, prefix));
+    }
+    stages.push_back(thread(normalize_stage, ref(pipeline), ref(state)));
+
+    string error;
+    // set when scanning fails (say, when -m cannot write a run file), after
+    // which the windows are only drained, so that the stages can finish
+    exception_ptr failure;
+
+    while (true) {
+        window_batch* batch = pipeline.full_windows.pop();
+        if (batch->end_of_input) {
+            error = batch->error;
+            break;
+        }
+        if (failure) {
+            pipeline.free_windows.push(batch);
+            continue;
+        }
+
+        try {
+            scan_segments(found, buffers, batch->segments, options);
+
+            const uintmax_t lines = batch->lines;
+            const uintmax_t bases = batch->bases;
+            pipeline.free_windows.push(batch);
+            batch = nullptr;
+
+            end_batch(found, options.num_threads);
+            progress.update(lines, bases);
+        } catch (...) {
+            failure = current_exception();
+            if (batch) {
+                pipeline.free_windows.push(batch);
+            }
+        }
+    }
+
+    for (auto it = stages.begin();  it != stages.end();  ++it) {
+        it->join();
+    }
+
+    if (failure) {
+        rethrow_exception(failure);
+    }
+    if (!error.empty()) {
+        throw runtime_error(error);
+    }
+
+    if (compressed) {
+        cerr << "Decompression time: " << pipeline.inflate_micros / 1000 << " ms" << endl;
+    }
+}
+
+
+// Scanning a mapped file
+// ----------------------
+//
+// With -i, the input file is mapped into memory and cut into pieces of
+// about STRIDE_SIZE bytes, which are normalized and scanned independently
+// by the worker threads.  Pieces never start inside a chromosome comment,
+// so a worker can normalize its piece from a fresh normalizer_state that
+// only needs the number of the read the piece starts in.  Instead of
+// carrying an overlap from the previous piece, each piece is extended with
+// up to k - 1 bases of the following sequence, stopping at the next
+// comment, so that k-mers crossing into the next piece are found exactly
+// once.
+
+// A chromosome comment: the '>' and the '\n' ending it.  An unterminated
+// comment ends at the end of the file.
+struct comment_range {
+    size_t begin;
+    size_t end;
+};
+
+
+// Find all chromosome comments, by jumping from '>' to '\n' to '>'.
+vector<comment_range> find_comments(const char* data, size_t size) {
+    vector<comment_range> comments;
+    size_t pos = 0;
+    while (pos < size) {
+        const char* gt = static_cast<const char*>(memchr(data + pos, '>', size - pos));
+        if (!gt) {
+            break;
+        }
+        const size_t begin = gt - data;
+        const char* nl = static_cast<const char*>(memchr(gt, '\n', size - begin));
+        const size_t end = nl ? nl - data : size;
+        comments.push_back(comment_range{begin, end});
+        pos = end + 1;
+    }
+    return comments;
+}
+
+
+// A piece of the mapped input, and the read its first base belongs to.
+struct input_piece {
+    size_t begin;
+    size_t end;
+    int64_t read;
+};
+
+
+// Cut [0, size) into pieces of about STRIDE_SIZE bytes, none of which
+// starts inside a comment.
+vector<input_piece> cut_pieces(size_t size, const vector<comment_range>& comments) {
+    vector<input_piece> pieces;
+    auto comment = comments.begin();
+    int64_t read = 0;
+    size_t begin = 0;
+    while (begin < size) {
+        size_t end = min(size, begin + STRIDE_SIZE);
+        // comments ending before end are done with
+        while (comment != comments.end() && comment->end < end) {
+            ++comment;
+        }
+        if (comment != comments.end() && comment->begin < end) {
+            // end is inside a comment, so move it past the '\n'
+            end = min(size, comment->end + 1);
+        }
+        pieces.push_back(input_piece{begin, end, read});
+        // each comment ending with '\n' starts a new read
+        for (auto it = lower_bound(comments.begin(), comments.end(), begin,
+                                   [](const comment_range& c, size_t pos) { return c.end < pos; });
+             it != comments.end() && it->end < end;  ++it) {
+            ++read;
+        }
+        begin = end;
+    }
+    return pieces;
+}
+
+
+// Append up to k - 1 normalized bases from data[pos ...) to window[len ...),
+// stopping at the next comment.  Returns the new len.
+int normalize_lookahead(const char* data, size_t size, size_t pos, char* window, int len) {
+    normalizer_state scratch;
+    vector<pair<int64_t, int64_t> > separator_indices;
+    for (int bases = 0;  bases < k - 1 && pos < size && data[pos] != '>';  ++pos) {
+        const int new_len = normalize(data + pos, 1, window, len, scratch, separator_indices);
+        bases += new_len - len;
+        len = new_len;
+    }
+    return len;
+}
+
+
+// The normalized window of a piece, and what scanning it found.
+struct piece_work {
+    vector<char> buffer;
+    vector<segment> segments;
+    scan_buffer out;
+    normalizer_state state;
+};
+
+
+void scan_piece(const char* data, size_t size, const input_piece& piece, piece_work& work,
+                const scan_options& options) {
+    // a piece may run past STRIDE_SIZE to the end of a comment
+    work.buffer.resize(piece.end - piece.begin + k);
+    char* window = work.buffer.data();
+
+    work.state = normalizer_state();
+    work.state.current_read = piece.read;
+
+    vector<pair<int64_t, int64_t> > separator_indices;
+    int len = normalize(data + piece.begin, piece.end - piece.begin, window, 0, work.state, separator_indices);
+    work.state.bases = len;
+    len = normalize_lookahead(data, size, piece.end, window, len);
+
+    work.segments.clear();
+    if (len >= k) {
+        cut_segments(window, len, work.state.current_read, separator_indices, work.segments);
+    }
+    for (auto it = work.segments.begin();  it != work.segments.end();  ++it) {
+        scan_segment(work.out, *it, it->buf, it->len, options);
+    }
+}
+
+
+// Scan the FASTA file at path by mapping it into memory.  Rounds of
+// num_threads pieces are scanned in parallel, and their results appended
+// in file order.
+void scan_mapped(const string& path, const scan_options& options, normalizer_state& state, scan_results& found) {
+    mapped_file file(path);
+    const char* data = file.data;
+    const size_t size = file.size;
+    if (size > 0) {
+        madvise(const_cast<char*>(data), size, MADV_SEQUENTIAL);
+    }
+
+    const vector<comment_range> comments = find_comments(data, size);
+    const vector<input_piece> pieces = cut_pieces(size, comments);
+
+    const int num_threads = max(1, options.num_threads);
+    vector<piece_work> work(num_threads);
+    progress_reporter progress;
+
+    for (size_t first = 0;  first < pieces.size();  first += num_threads) {
+        const int round = (int) min((size_t) num_threads, pieces.size() - first);
+        run_in_parallel(round, [&](int t) {
+            scan_piece(data, size, pieces[first + t], work[t], options);
+        });
+        for (int t = 0;  t < round;  ++t) {
+            append_results(found, work[t].out);
+
+            state.lines += work[t].state.lines;
+            state.bases += work[t].state.bases;
+            state.num_ambiguous += work[t].state.num_ambiguous;
+            state.current_read = work[t].state.current_read;
+        }
+        end_batch(found, num_threads);
+        progress.update(state.lines, state.bases);
+    }
+}
+
+
+// Two-pass scan
+// -------------
+//
+// With -c, a mapped file is scanned twice instead of collecting its results
+// and sorting them.  The first pass only counts the guides that fall in each
+// of COUNT_BUCKETS buckets, by their top COUNT_BUCKET_BITS bits.  That sizes
+// the result array exactly and gives each bucket its own range of it.  The
+// second pass scans again and puts every guide straight into its bucket, so
+// sorting the small buckets one by one sorts the whole array.
+
+constexpr int COUNT_BUCKET_BITS = 16;
+constexpr size_t COUNT_BUCKETS = size_t(1) << COUNT_BUCKET_BITS;
+
+typedef vector<uint64_t> bucket_counts;
+
+
+inline size_t count_bucket(int64_t code) {
+    return (uint64_t) code >> (code_bits - COUNT_BUCKET_BITS);
+}
+
+
+void count_buckets(bucket_counts& counts, const vector<int64_t>& codes) {
+    for (auto it = codes.begin();  it != codes.end();  ++it) {
+        ++counts[count_bucket(*it)];
+    }
+}
+
+
+// Scan the FASTA file at path in two passes, and return its guides sorted.
+vector<int64_t> scan_mapped_counted(const string& path, const scan_options& options, normalizer_state& state) {
+    mapped_file file(path);
+    const char* data = file.data;
+    const size_t size = file.size;
+
+    const vector<comment_range> comments = find_comments(data, size);
+    const vector<input_piece> pieces = cut_pieces(size, comments);
+
+    const int num_threads = max(1, options.num_threads);
+    vector<piece_work> work(num_threads);
+    vector<bucket_counts> counts(num_threads, bucket_counts(COUNT_BUCKETS));
+
+    // first pass: count
+    progress_reporter progress;
+    for (size_t first = 0;  first < pieces.size();  first += num_threads) {
+        const int round = (int) min((size_t) num_threads, pieces.size() - first);
+        run_in_parallel(round, [&](int t) {
+            scan_piece(data, size, pieces[first + t], work[t], options);
+            count_buckets(counts[t], work[t].out.results);
+            work[t].out.results.clear();
+        });
+        for (int t = 0;  t < round;  ++t) {
+            state.lines += work[t].state.lines;
+            state.bases += work[t].state.bases;
+            state.num_ambiguous += work[t].state.num_ambiguous;
+            state.current_read = work[t].state.current_read;
+        }
+        progress.update(state.lines, state.bases);
+    }
+
+    // bucket b is results[bucket_start[b] ... bucket_start[b + 1])
+    vector<uint64_t> bucket_start(COUNT_BUCKETS + 1, 0);
+    for (size_t b = 0;  b < COUNT_BUCKETS;  ++b) {
+        bucket_start[b + 1] = bucket_start[b];
+        for (int t = 0;  t < num_threads;  ++t) {
+            bucket_start[b + 1] += counts[t][b];
+        }
+    }
+    cerr << "Counted " << bucket_start[COUNT_BUCKETS] << " candidate guides." << endl;
+
+    vector<int64_t> results(bucket_start[COUNT_BUCKETS]);
+    vector<uint64_t> bucket_end(bucket_start.begin(), bucket_start.end() - 1);
+
+    // second pass: place each guide in its bucket
+    uintmax_t lines = 0;
+    uintmax_t bases = 0;
+    for (size_t first = 0;  first < pieces.size();  first += num_threads) {
+        const int round = (int) min((size_t) num_threads, pieces.size() - first);
+        run_in_parallel(round, [&](int t) {
+            scan_piece(data, size, pieces[first + t], work[t], options);
+            fill(counts[t].begin(), counts[t].end(), 0);
+            count_buckets(counts[t], work[t].out.results);
+        });
+        // give each piece its own range of every bucket; counts become
+        // the positions to write to
+        for (size_t b = 0;  b < COUNT_BUCKETS;  ++b) {
+            for (int t = 0;  t < round;  ++t) {
+                const uint64_t n = counts[t][b];
+                counts[t][b] = bucket_end[b];
+                bucket_end[b] += n;
+            }
+            if (bucket_end[b] > bucket_start[b + 1]) {
+                throw runtime_error(path + " changed while it was scanned");
+            }
+        }
+        run_in_parallel(round, [&](int t) {
+            const vector<int64_t>& codes = work[t].out.results;
+            for (auto it = codes.begin();  it != codes.end();  ++it) {
+                results[counts[t][count_bucket(*it)]++] = *it;
+            }
+            work[t].out.results.clear();
+        });
+        for (int t = 0;  t < round;  ++t) {
+            lines += work[t].state.lines;
+            bases += work[t].state.bases;
+        }
+        progress.update(lines, bases);
+    }
+
+    cerr << "Sorting " << results.size() << " candidate guides in " << COUNT_BUCKETS << " buckets." << endl;
+    run_in_parallel(num_threads, [&](int t) {
+        const size_t end = block_start(COUNT_BUCKETS, t + 1, num_threads);
+        for (size_t b = block_start(COUNT_BUCKETS, t, num_threads);  b < end;  ++b) {
+            sort(results.begin() + bucket_start[b], results.begin() + bucket_start[b + 1]);
+        }
+    });
+    return results;
+}
+
+
+// Where streamed output goes: stdout or the -o file, through a
+// block_compressor with -z or -Z.  finish() must be called when done.
+class output_target {
+public:
+    explicit output_target(const scan_options& options) : fd(fileno(stdout)) {
+        if (!options.output_path.empty()) {
+            fd = open(options.output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd == -1) {
+                throw runtime_error("cannot create " + options.output_path + ": " + strerror(errno));
+            }
+        }
+        if (options.compression == output_compression::none) {
+            out.reset(new output_writer(fd));
+        } else {
+            compressor.reset(new block_compressor(fd, options.compression, options.num_threads));
+            block_compressor* c = compressor.get();
+            out.reset(new output_writer([c](const char* data, size_t len) { c->write(data, len); }));
+        }
+    }
+
+    ~output_target() {
+        out.reset();
+        compressor.reset();
+        if (fd != fileno(stdout)) {
+            close(fd);
+        }
+    }
+
+    output_writer& writer() { return *out; }
+
+    void finish() {
+        out->flush();
+        if (compressor) {
+            compressor->finish();
+        }
+    }
+
+private:
+    int fd;
+    unique_ptr<block_compressor> compressor;
+    unique_ptr<output_writer> out;
+};
+
+
+// Write the distinct codes of a merge in the output format, and return
+// how many there are.  merge(f) calls f(code) for all codes in increasing
+// order, repeats included, and is called twice for -b and -e, whose
+// headers need the count.
+template <typename Merge>
+uint64_t write_merged_guides(output_writer& out, const Merge& merge, const scan_options& options, uint32_t flags) {
+    uint64_t guides = 0;
+    // 0 is not a valid code
+    int64_t last = 0;
+    if (options.format == output_format::binary || options.format == output_format::elias_fano) {
+        merge([&](int64_t code) {
+            guides += code != last;
+            last = code;
+        });
+    }
+    if (options.format == output_format::elias_fano) {
+        elias_fano_builder builder(k, bits_per_base, flags, guides);
+        merge([&](int64_t code) {
+            builder.add(code);
+        });
+        write_elias_fano_file(out, builder);
+    } else if (options.format == output_format::binary) {
+        const guide_file_header header = make_guide_file_header(k, bits_per_base, flags, guides);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        last = 0;
+        merge([&](int64_t code) {
+            if (code != last) {
+                out.write(reinterpret_cast<const char*>(&code), sizeof(code));
+            }
+            last = code;
+        });
+    } else if (options.format == output_format::fuse_filter) {
+        fuse_filter_builder builder(k, bits_per_base, flags, options.num_threads);
+        merge([&](int64_t code) {
+            guides += code != last;
+            builder.add(code);
+            last = code;
+        });
+        write_fuse_filter_file(out, builder);
+    } else if (options.format == output_format::delta) {
+        delta_guide_encoder encoder(k, bits_per_base, flags);
+        merge([&](int64_t code) {
+            guides += code != last;
+            encoder.add(code);
+            last = code;
+        });
+        write_delta_guide_file(out, encoder);
+    } else {
+        merge([&](int64_t code) {
+            if (code != last) {
+                char* obuf = out.reserve(k - 2);
+                decode_guide(obuf, code);
+                obuf[k - 3] = '\n';
+                out.commit(k - 2);
+                ++guides;
+            }
+            last = code;
+        });
+    }
+    return guides;
+}
+
+
+// The codes of the spilled runs, merged, for write_merged_guides.
+struct merged_run_codes {
+    const vector<unique_ptr<spill_run> >& runs;
+
+    template <typename F>
+    void operator()(F f) const {
+        merge_runs<int64_t>(runs, f);
+    }
+};
+
+
+// Merge the spilled runs, and write their distinct guides just as
+// scan_stdin writes the sorted results.
+void write_merged_runs(const scan_results& found, const scan_options& options, int64_t current_read) {
+    cerr << "Merging " << found.spilled.size() << " spilled runs." << endl;
+
+    // the merge streams, even into an -o file
+    output_target target(options);
+    output_writer& out = target.writer();
+    uint64_t guides = 0;
+
+    if (options.output_reads) {
+        out.write("Total reads: ");
+        out.write_uint(current_read);
+        out.put('\n');
+
+        read_site last = {0, 0};
+        merge_runs<read_site>(found.spilled, [&](const read_site& site) {
+            if (site.code != last.code) {
+                if (guides > 0) {
+                    out.put('\n');
+                }
+                char* obuf = out.reserve(k - 2);
+                decode_guide(obuf, site.code);
+                obuf[k - 3] = '\t';
+                out.commit(k - 2);
+                out.write_uint(site.read);
+                ++guides;
+            } else if (site.read != last.read) {
+                out.put(' ');
+                out.write_uint(site.read);
+            }
+            last = site;
+        });
+        if (guides > 0) {
+            out.put('\n');
+        }
+    } else {
+        guides = write_merged_guides(out, merged_run_codes{found.spilled}, options, found.spill_flags);
+    }
+
+    cerr << "Output " << guides << " unique guides." << endl;
+    target.finish();
+}
+
+
+// Build the read postings of the sorted read sites, releasing the sites.
+read_postings make_read_postings(vector<read_site>& sites, bool compressed) {
+    size_t guides = 0;
+    for (size_t i = 0;  i < sites.size();  ++i) {
+        guides += i == 0 || sites[i - 1].code != sites[i].code;
+    }
+    read_postings postings(compressed);
+    postings.reserve(guides, sites.size());
+    for (auto it = sites.begin();  it != sites.end();  ++it) {
+        postings.add(it->code, it->read);
+    }
+    vector<read_site>().swap(sites);
+    return postings;
+}
+
+
+void report_read_postings(const read_postings& postings) {
+    size_t max_reads = 0;
+    size_t max_reads_guide = 0;
+    for (size_t i = 0;  i < postings.size();  ++i) {
+        const size_t n = postings.num_reads(i);
+        if (n > max_reads) {
+            max_reads = n;
+            max_reads_guide = i;
+        }
+    }
+
+    cerr << "Unique sites to reads: " << postings.size() << endl;
+    cerr << "Read postings take " << postings.memory_bytes() / (1024 * 1024) << " MB." << endl;
+    cerr << "Guide " << max_reads_guide << " had largest number of reads: " << max_reads << endl;
+    cerr << "Outputting " << postings.size() << " unique guides." << endl;
+}
+
+
+// Sort the -P results, and return their distinct guide codes.
+vector<int64_t> sorted_packed_guides(scan_results& found, int num_threads) {
+    cerr << "Sorting " << found.packed_results.size() << " packed candidate guides." << endl;
+    radix_sort(found.packed_results, [](const packed_guide& g) { return packed_value(g); },
+               PACKED_GUIDE_BITS, num_threads);
+    vector<packed_guide> packed;
+    found.packed_results.move_to(packed);
+    packed.erase(unique(packed.begin(), packed.end(),
+                        [](const packed_guide& a, const packed_guide& b) {
+                            return packed_value(a) == packed_value(b);
+                        }),
+                 packed.end());
+
+    vector<int64_t> distinct(packed.size());
+    for (size_t i = 0;  i < packed.size();  ++i) {
+        distinct[i] = unpack_guide(packed_value(packed[i]));
+    }
+    return distinct;
+}
+
+
+// Write the -r output: each distinct guide and the reads it was found in.
+void write_read_postings(const read_postings& postings, int64_t current_read, const scan_options& options) {
+    output_target target(options);
+    output_writer& out = target.writer();
+    out.write("Total reads: ");
+    out.write_uint(current_read);
+    out.put('\n');
+
+    for (size_t i = 0;  i < postings.size();  ++i) {
+        char* obuf = out.reserve(k - 2);
+        decode_guide(obuf, postings.code(i));
+        obuf[k - 3] = '\t';
+        out.commit(k - 2);
+        bool first = true;
+        postings.for_each_read(i, [&](uint64_t read) {
+            if (!first) {
+                out.put(' ');
+            }
+            out.write_uint(read);
+            first = false;
+        });
+        out.put('\n');
+    }
+
+    target.finish();
+}
+
+
+// Output to a file
+// ----------------
+//
+// With -o, the size of the output is known before any of it is written:
+// k - 2 bytes per distinct guide as text, or the code size with -b, and
+// with -r the sum of the line lengths.  So the output file is sized and
+// mapped up front, and each thread formats a block of the guides straight
+// into its own part of the file.
+
+// Write the distinct codes as text lines to path.
+void write_guides_mapped(const string& path, const vector<int64_t>& distinct, int num_threads) {
+    constexpr size_t line_length = k - 2;  // the guide and a newline
+    mapped_output out(path, distinct.size() * line_length);
+    run_in_parallel(num_threads, [&](int t) {
+        const size_t end = block_start(distinct.size(), t + 1, num_threads);
+        for (size_t i = block_start(distinct.size(), t, num_threads);  i < end;  ++i) {
+            char* obuf = out.data + i * line_length;
+            decode_guide(obuf, distinct[i]);
+            obuf[k - 3] = '\n';
+        }
+    });
+}
+
+
+// Write the distinct codes as a binary guide file to path.
+void write_guide_file_mapped(const string& path, const vector<int64_t>& distinct, uint32_t flags, int num_threads) {
+    const guide_file_header header = make_guide_file_header(k, bits_per_base, flags, distinct.size());
+    mapped_output out(path, sizeof(header) + distinct.size() * sizeof(int64_t));
+    memcpy(out.data, &header, sizeof(header));
+    run_in_parallel(num_threads, [&](int t) {
+        const size_t begin = block_start(distinct.size(), t, num_threads);
+        const size_t end = block_start(distinct.size(), t + 1, num_threads);
+        memcpy(out.data + sizeof(header) + begin * sizeof(int64_t), distinct.data() + begin,
+               (end - begin) * sizeof(int64_t));
+    });
+}
+
+
+// Write the -r output to path.  Each thread first measures its block of
+// guides, and a prefix sum over the blocks gives where each one starts.
+void write_read_postings_mapped(const string& path, const read_postings& postings, int64_t current_read,
+                                int num_threads) {
+    const string total = "Total reads: " + to_string(current_read) + "\n";
+
+    // block_offset[t] is where block t starts
+    vector<uint64_t> block_offset(num_threads + 1, 0);
+    run_in_parallel(num_threads, [&](int t) {
+        const size_t end = block_start(postings.size(), t + 1, num_threads);
+        uint64_t bytes = 0;
+        for (size_t i = block_start(postings.size(), t, num_threads);  i < end;  ++i) {
+            // the guide, a tab, and each read followed by a space or newline
+            bytes += k - 2;
+            postings.for_each_read(i, [&](uint64_t read) { bytes += decimal_digits(read) + 1; });
+        }
+        block_offset[t + 1] = bytes;
+    });
+    block_offset[0] = total.size();
+    partial_sum(block_offset.begin(), block_offset.end(), block_offset.begin());
+
+    mapped_output out(path, block_offset[num_threads]);
+    memcpy(out.data, total.data(), total.size());
+    run_in_parallel(num_threads, [&](int t) {
+        const size_t end = block_start(postings.size(), t + 1, num_threads);
+        char* obuf = out.data + block_offset[t];
+        for (size_t i = block_start(postings.size(), t, num_threads);  i < end;  ++i) {
+            decode_guide(obuf, postings.code(i));
+            obuf[k - 3] = '\t';
+            obuf += k - 2;
+            postings.for_each_read(i, [&](uint64_t read) {
+                obuf = format_uint(obuf, read);
+                *obuf++ = ' ';
+            });
+            obuf[-1] = '\n';
+        }
+        assert(obuf == out.data + block_offset[t + 1]);
+    });
+}
+
+
+// The sorted results merged with the variants of the wildcard guides, for
+// write_merged_guides.
+struct results_and_variants {
+    const vector<int64_t>& results;
+    const wildcard_table& table;
+
+    template <typename F>
+    void operator()(F f) const {
+        auto it = results.begin();
+        table.for_each_variant([&](int64_t code) {
+            for (;  it != results.end() && *it < code;  ++it) {
+                f(*it);
+            }
+            f(code);
+        });
+        for (;  it != results.end();  ++it) {
+            f(*it);
+        }
+    }
+};
+
+
+// With -w, the guides with N bases were kept as wildcard guides.  Write
+// their distinct variants merged into the sorted results.  The variants
+// are made in order as they are written, never held all at once.
+void write_with_wildcard_variants(const vector<int64_t>& results, vector<wildcard_guide>& wildcards,
+                                  const scan_options& options) {
+    const wildcard_table table(move(wildcards), options.num_threads);
+    wildcards.clear();
+    cerr << "Expanding " << table.size() << " distinct wildcard guides." << endl;
+
+    // the merge streams, even into an -o file
+    output_target target(options);
+    const uint64_t guides = write_merged_guides(target.writer(), results_and_variants{results, table}, options,
+                                                GUIDE_FILE_N_EXPANDED);
+    cerr << "Output " << guides << " unique guides." << endl;
+    target.finish();
+}
+
+
+bool is_gzip_file(const string& path) {
+    mapped_file file(path);
+    return is_gzip(file.data, file.size);
+}
+
+
+void scan_stdin(const scan_options& options) {
+    init_encoding();
+    set_N_policy(options.max_N, options.expand_N_variants);
+
+    const bool output_reads = options.output_reads;
+
+    scan_results found(options.huge_pages);
+    found.deduplicate = options.dedup_batches;
+    found.packed = options.packed_guides;
+    found.spill_bytes = options.memory_budget;
+    found.spill_dir = options.spill_dir;
+    found.spill_reads = options.output_reads;
+    found.spill_flags = options.expand_N_variants ? GUIDE_FILE_N_EXPANDED : 0;
+
+    uintmax_t guides = 0;
+
+    normalizer_state state;
+
+    vector<int64_t> results;
+
+    if (options.count_first) {
+        if (options.input_path.empty() || is_gzip_file(options.input_path)) {
+            throw runtime_error("-c needs an uncompressed FASTA file, given with -i");
+        }
+        results = scan_mapped_counted(options.input_path, options, state);
+    } else if (options.input_path.empty()) {
+        scan_stream(fileno(stdin), options, state, found);
+    } else if (is_gzip_file(options.input_path)) {
+        // compressed files cannot be scanned in place
+        const int fd = open(options.input_path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw runtime_error("cannot open " + options.input_path + ": " + strerror(errno));
+        }
+        scan_stream(fd, options, state, found);
+        close(fd);
+    } else {
+        scan_mapped(options.input_path, options, state, found);
+    }
+
+    const int64_t current_read = state.current_read;
+
+    // with -c, -u or -P, the results come sorted already
+    const bool presorted = options.count_first || options.dedup_batches || options.packed_guides;
+
+    if (!found.spilled.empty()) {
+        // with -m, the last results join the runs on disk
+        if (!found.results.empty()) {
+            spill_results(found, max(1, options.num_threads));
+        }
+    } else if (options.packed_guides) {
+        results = sorted_packed_guides(found, max(1, options.num_threads));
+    } else if (options.dedup_batches) {
+        cerr << "Merging " << found.runs.num_runs() << " runs of " << found.runs.size() << " sorted guides." << endl;
+        results = found.runs.finish();
+    }
+    
+    cerr << "Finished reading input."  << endl;
+    cerr << "Total lines: "  << state.lines  << endl;
+    cerr << "Total bases: "  << state.bases  << endl;
+    if (state.num_ambiguous > 0) {
+	cerr << "Converted " << state.num_ambiguous << " ambiguous bases to N" << endl;
+    }
+
+    if (!found.spilled.empty()) {
+        write_merged_runs(found, options, current_read);
+        return;
+    }
+
+    // -r sorts (code, read) records once, and turns them into read postings
+    if (output_reads) {
+        cerr << "Sorting " << found.results.size() << " candidate sites." << endl;
+        vector<read_site> sites = sorted_read_sites(found, options.num_threads);
+        // uint32_t read indexes only go so far
+        const bool compressed = options.compress_postings || current_read > (int64_t) UINT32_MAX;
+        const read_postings postings = make_read_postings(sites, compressed);
+        report_read_postings(postings);
+        if (options.output_path.empty() || options.compression != output_compression::none) {
+            write_read_postings(postings, current_read, options);
+        } else {
+            write_read_postings_mapped(options.output_path, postings, current_read, max(1, options.num_threads));
+        }
+        return;
+    }
+    
+    // If there are tons of duplicates, -u sorts each batch and merges
+    // incrementally with set_union (see sorted_runs.hpp), rather than doing
+    // a huge sort at the end, and -c leaves no sort to do.  Otherwise the
+    // sort is a radix sort over the code_bits low bits, parallel with -t.
+    // It sorts the chunks in place, releasing them pass by pass, and only
+    // then are they copied into one array, a chunk at a time.
+    if (!presorted) {
+        cerr << "Sorting " << found.results.size() << " candidate guides." << endl;
+        radix_sort(found.results, code_bits, options.num_threads);
+        found.results.move_to(results);
+    }
+
+    if (options.lazy_wildcards) {
+        write_with_wildcard_variants(results, found.wildcards, options);
+        return;
+    }
+    
+    // 0 is not a valid code
+    int64_t last = 0;
+    for (auto it = results.begin();  it != results.end();  ++it) {
+        if (*it != last) {
+            ++guides;
+        }
+        last = *it;
+    }
+
+    cerr << "Outputting " << guides << " unique guides." << endl;
+
+    // compressed output and the compact formats stream, even into an -o file
+    if (!options.output_path.empty() && options.compression == output_compression::none
+        && (options.format == output_format::text || options.format == output_format::binary)) {
+        results.erase(unique(results.begin(), results.end()), results.end());
+        const int num_threads = max(1, options.num_threads);
+        if (options.format == output_format::binary) {
+            write_guide_file_mapped(options.output_path, results,
+                                    options.expand_N_variants ? GUIDE_FILE_N_EXPANDED : 0, num_threads);
+        } else {
+            write_guides_mapped(options.output_path, results, num_threads);
+        }
+        return;
+    }
+
+    output_target target(options);
+    output_writer& out = target.writer();
+
+    if (options.format == output_format::binary) {
+	write_guide_file(out, results, guides, options.expand_N_variants ? GUIDE_FILE_N_EXPANDED : 0);
+    } else if (options.format == output_format::delta) {
+        delta_guide_encoder encoder(k, bits_per_base, options.expand_N_variants ? GUIDE_FILE_N_EXPANDED : 0);
+        for (auto it = results.begin();  it != results.end();  ++it) {
+            encoder.add(*it);
+        }
+        write_delta_guide_file(out, encoder);
+    } else if (options.format == output_format::elias_fano) {
+        elias_fano_builder builder(k, bits_per_base, options.expand_N_variants ? GUIDE_FILE_N_EXPANDED : 0, guides);
+        for (auto it = results.begin();  it != results.end();  ++it) {
+            builder.add(*it);
+        }
+        write_elias_fano_file(out, builder);
+    } else if (options.format == output_format::fuse_filter) {
+        fuse_filter_builder builder(k, bits_per_base, options.expand_N_variants ? GUIDE_FILE_N_EXPANDED : 0,
+                                    options.num_threads);
+        for (auto it = results.begin();  it != results.end();  ++it) {
+            builder.add(*it);
+        }
+        write_fuse_filter_file(out, builder);
+    } else {
+	write_guides(out, results);
+    }
+
+    target.finish();
+}
+
+
+void scan_stdin(bool output_reads) {
+    scan_options options;
+    options.output_reads = output_reads;
+    scan_stdin(options);
+}
+
+
+void silent_tests() {
+    const char* kmer                = "ACGTGGTGGCAATGCACGGT";
+    const char* kmer_complement     = "TGCACCACCGTTACGTGCCA";
+    const char* kmer_2wc            = "ACGTGGTGGCAATNCACGGN";
+    const char* kmer_2wc_complement = "TGCACCACCGTTANGTGCCN";
+    const char* kmer_own_complement = "NNNNNNNNNNNNNNNNNNNN";
+    const char* nonse               = "abcdefghijklmnopqrst";
+    char buf[k-2];
+    assert(strlen(kmer) == k - 3);
+    assert(strlen(kmer_complement) == k - 3);
+    assert(strlen(kmer_2wc) == k - 3);
+    assert(strlen(kmer_2wc_complement) == k - 3);
+    assert(strlen(nonse) == k - 3);
+    assert(strlen(nonse) == sizeof(buf) - 1);
+    // ----------------
+    strcpy(buf, nonse);
+    assert(0 == strcmp(buf, nonse));
+    decode(buf, k-3, encode<k - 3>(kmer));
+    assert(0 == strcmp(buf, kmer));
+    // ----------------
+    strcpy(buf, nonse);
+    assert(0 == strcmp(buf, nonse));
+    decode(buf, k-3, complement(encode<k - 3>(kmer)));
+    assert(0 == strcmp(buf, kmer_complement));
+    // ----------------
+    strcpy(buf, nonse);
+    assert(0 == strcmp(buf, nonse));
+    decode(buf, k-3, complement(encode<k - 3>(kmer_complement)));
+    assert(0 == strcmp(buf, kmer));
+    // ----------------
+    strcpy(buf, nonse);
+    assert(0 == strcmp(buf, nonse));
+    decode(buf, k-3, encode<k - 3>(kmer_2wc));
+    assert(0 == strcmp(buf, kmer_2wc));
+    // ----------------
+    strcpy(buf, nonse);
+    assert(0 == strcmp(buf, nonse));
+    decode(buf, k-3, complement(encode<k - 3>(kmer_2wc)));
+    assert(0 == strcmp(buf, kmer_2wc_complement));
+    // ----------------
+    strcpy(buf, nonse);
+    assert(0 == strcmp(buf, nonse));
+    decode(buf, k-3, complement(encode<k - 3>(kmer_2wc_complement)));
+    assert(0 == strcmp(buf, kmer_2wc));
+    // ----------------
+    strcpy(buf, nonse);
+    assert(0 == strcmp(buf, nonse));
+    auto oc_code = encode<k - 3>(kmer_own_complement);
+    assert(oc_code == complement(oc_code));
+    // ----------------
+    strcpy(buf, nonse);
+    decode_guide(buf, encode<k - 3>(kmer_2wc));
+    assert(0 == strcmp(buf, kmer_2wc));
+    // ----------------
+    vector<int64_t> expansions;
+    const char* expected[] = {
+        "ACGTGGTGGCAATACACGGA",
+        "ACGTGGTGGCAATACACGGC",
+        "ACGTGGTGGCAATACACGGG",
+        "ACGTGGTGGCAATACACGGT",
+        "ACGTGGTGGCAATCCACGGA",
+        "ACGTGGTGGCAATCCACGGC",
+        "ACGTGGTGGCAATCCACGGG",
+        "ACGTGGTGGCAATCCACGGT",
+        "ACGTGGTGGCAATGCACGGA",
+        "ACGTGGTGGCAATGCACGGC",
+        "ACGTGGTGGCAATGCACGGG",
+        "ACGTGGTGGCAATGCACGGT",
+        "ACGTGGTGGCAATTCACGGA",
+        "ACGTGGTGGCAATTCACGGC",
+        "ACGTGGTGGCAATTCACGGG",
+        "ACGTGGTGGCAATTCACGGT",
+    };
+    emit_all_variants<false>(expansions, kmer_2wc, 2);
+    for (int i=0; i<16; ++i) {
+        decode(buf, k - 3, expansions[i]);
+        assert(0 == strcmp(expected[i], buf));
+    }
+    if (false) {
+        // This is good but not silent.
+        for (auto it = expansions.begin();   it != expansions.end();   ++it) {
+            strcpy(buf, nonse);
+            assert(0 == strcmp(buf, nonse));
+            decode(buf, k - 3, *it);
+            cout << buf << endl;
+        }
+    }
+}
+
+// Why the options cannot be used together, or nullptr if they can.
+const char* option_conflict(const scan_options& options) {
+    if (options.output_reads && options.format != output_format::text) {
+        return "-r output is only available as text";
+    }
+    if (options.output_reads && options.lazy_wildcards) {
+        return "-r cannot be combined with -w";
+    }
+    if (options.count_first && (options.output_reads || options.lazy_wildcards)) {
+        return "-c cannot be combined with -r or -w";
+    }
+    if (options.dedup_batches && (options.output_reads || options.count_first)) {
+        return "-u cannot be combined with -r or -c";
+    }
+    if (options.memory_budget > 0 && (options.count_first || options.dedup_batches || options.lazy_wildcards)) {
+        return "-m cannot be combined with -c, -u or -w";
+    }
+    if (options.packed_guides && (!options.expand_N_variants || options.output_reads || options.count_first
+                                  || options.dedup_batches || options.memory_budget > 0)) {
+        return "-P cannot be combined with -x, -r, -c, -u or -m";
+    }
+    if (options.lazy_wildcards && !options.expand_N_variants) {
+        return "-w cannot be combined with -x";
+    }
+    return nullptr;
+}
+
+
+// Read all of arg as a decimal number from min to max into value.  Returns
+// false for anything else, such as "abc", "2x" or a number out of range.
+bool parse_number(const char* arg, long long min, long long max, long long& value) {
+    char* end;
+    errno = 0;
+    const long long x = strtoll(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno == ERANGE || x < min || x > max) {
+        return false;
+    }
+    value = x;
+    return true;
+}
+
+
+void print_usage(char* program_name) {
+    cerr << endl << "read a FASTA file from stdin and output crispr guide 20-mers to stdout, e.g.," << endl << endl;
+
+    cerr << "\t cat input.fa | " << program_name << " >! output.txt" << endl;
+
+    cerr << endl << "Optional command line arguments:" << endl << endl;
+
+    cerr << program_name << " -[r|b|d|e|f|h] [-p] [-w|-x] [-n M] [-c|-u|-m MB [-T D]] [-P] [-H]" << endl;
+    cerr << "\t [-z|-Z] [-t threads] [-i input.fa] [-o output]" << endl;
+
+    cerr << "\t -r \t Output the reads that each CRISPR site matches, use this for DASHit" << endl;
+    cerr << "\t -t N \t Scan and sort with N threads (default 1)" << endl;
+    cerr << "\t -p \t With -r, keep the read lists delta and varint compressed in memory" << endl;
+    cerr << "\t -b \t Output a binary guide file (see guide_file.hpp) instead of text" << endl;
+    cerr << "\t -d \t Output a delta guide file (see delta_guide_file.hpp), several times smaller than -b" << endl;
+    cerr << "\t -e \t Output an Elias-Fano guide file (see elias_fano.hpp) for membership and rank queries" << endl;
+    cerr << "\t -f \t Output a binary fuse filter file (see fuse_filter.hpp), 9 bits per guide, built with -t threads" << endl;
+    cerr << "\t -z \t Compress the output with gzip, on -t threads" << endl;
+    cerr << "\t -Z \t Compress the output with zstd, on -t threads" << (zstd_available() ? "" : " (not in this build)") << endl;
+    cerr << "\t -o F \t Write the output to file F, formatting it with -t threads" << endl;
+    cerr << "\t -i F \t Read FASTA file F instead of stdin; uncompressed files are mapped into memory" << endl;
+    cerr << "\t -w \t Keep guides with N bases as wildcards until output, instead of expanding them while scanning" << endl;
+    cerr << "\t -n M \t Permit at most M N characters per 23-mer, PAM included (default " << default_max_N
+         << ", at most " << max_max_N << ")" << endl;
+    cerr << "\t -c \t With -i, scan twice to count and then place the guides, using only as much memory as they need" << endl;
+    cerr << "\t -u \t Sort and deduplicate the guides batch by batch while scanning, for very repetitive input" << endl;
+    cerr << "\t -m MB \t Keep about MB megabytes of results in memory, and sort the rest through run files;" << endl;
+    cerr << "\t \t checked after each 32 MB window of input (-t windows with -i), so the results can pass MB" << endl;
+    cerr << "\t \t by what those windows find" << endl;
+    cerr << "\t -T D \t Write -m run files to directory D (default $TMPDIR or /tmp)" << endl;
+    cerr << "\t -P \t Keep the guides in 5-byte 2-bit form until output, which saves memory; needs N expansion" << endl;
+    cerr << "\t -H \t Ask for transparent huge pages for the scan results" << endl;
+    cerr << "\t -x \t Output guides with N characters as they are, instead of all their ACGT variants" << endl;
+    cerr << "\t -h \t Print this help" << endl;
+}
+
+
+// when compiling unit tests, the unit testing framework provides its own main()
+#ifndef UNIT_TESTS
+int main(int argc, char** argv) {
+    int opt;
+    long long number;
+
+    scan_options options;
+
+    cerr << PROGRAM_NAME << " " << PROGRAM_VERSION << endl;
+    
+    if (getenv("TMPDIR")) {
+        options.spill_dir = getenv("TMPDIR");
+    }
+
+    while ((opt = getopt(argc,argv,"rbcdefpuwxzZHPhi:m:n:o:t:T:")) != -1) {
+        switch (opt) {
+        case 'r':
+            options.output_reads = true;
+	    cerr << "Outputting read indices for DASHit use" << endl;
+            break;
+        case 'b':
+            options.format = output_format::binary;
+            break;
+        case 'd':
+            options.format = output_format::delta;
+            break;
+        case 'e':
+            options.format = output_format::elias_fano;
+            break;
+        case 'f':
+            options.format = output_format::fuse_filter;
+            break;
+        case 'p':
+            options.compress_postings = true;
+            break;
+        case 'w':
+            options.lazy_wildcards = true;
+            break;
+        case 'n':
+            if (!parse_number(optarg, 0, max_max_N, number)) {
+                cerr << "-n requires a number from 0 to " << max_max_N << endl;
+                exit(1);
+            }
+            options.max_N = (int) number;
+            break;
+        case 'x':
+            options.expand_N_variants = false;
+            break;
+        case 'c':
+            options.count_first = true;
+            break;
+        case 'u':
+            options.dedup_batches = true;
+            break;
+        case 'm':
+            if (!parse_number(optarg, 1, LLONG_MAX >> 20, number)) {
+                cerr << "-m requires a positive number of megabytes" << endl;
+                exit(1);
+            }
+            options.memory_budget = (uint64_t) number * 1024 * 1024;
+            break;
+        case 'T':
+            options.spill_dir = optarg;
+            break;
+        case 'P':
+            options.packed_guides = true;
+            break;
+        case 'z':
+            options.compression = output_compression::gzip;
+            break;
+        case 'Z':
+            if (!zstd_available()) {
+                cerr << "-Z needs crispr_sites built with zstd" << endl;
+                exit(1);
+            }
+            options.compression = output_compression::zstd;
+            break;
+        case 'H':
+            options.huge_pages = true;
+            break;
+        case 'i':
+            options.input_path = optarg;
+            break;
+        case 'o':
+            options.output_path = optarg;
+            break;
+        case 't':
+            if (!parse_number(optarg, 1, INT_MAX, number)) {
+                cerr << "-t requires a positive number of threads" << endl;
+                exit(1);
+            }
+            options.num_threads = (int) number;
+            cerr << "Scanning with " << options.num_threads << " threads" << endl;
+            break;
+        case '?':
+        case 'h':
+            print_usage(argv[0]);
+            exit(0);
+            break;
+        }
+    }
 
     cerr << argv[0] << " -h for usage" << endl;
+
+    const char* conflict = option_conflict(options);
+    if (conflict) {
+        cerr << conflict << endl;
+        exit(1);
+    }
     
     init_encoding();
     silent_tests();
-    scan_stdin(output_reads);
+    try {
+        scan_stdin(options);
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        exit(1);
+    }
     return 0;
 }
 #endif
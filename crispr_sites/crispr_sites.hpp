@@ -1,8 +1,97 @@
+#ifndef CRISPR_SITES_HPP
+#define CRISPR_SITES_HPP
+
+#include <cstdint>
+#include <string>
+
 // Look for 20-mers at PAM sites.  Including NGG or CCN, k=23.
 constexpr auto k = 23;
 
+// guides are encoded with this many bits per base
+constexpr int bits_per_base = 3;
+
 // input will be read STRIDE_SIZE at a time
 constexpr auto STRIDE_SIZE = 32 * 1024 * 1024;
 
 // to scan for k-mers, consecutive read windows must overlap by k-1 characters
 constexpr auto BUFFER_SIZE = STRIDE_SIZE + k - 1;
+
+
+// Defaults for -n and -x; see crispr_sites.cpp.
+constexpr int default_max_N = 2;
+constexpr bool default_expand_N_variants = true;
+
+// -n accepts at most this many N per 23-mer
+constexpr int max_max_N = 5;
+
+
+enum class output_format {
+    text,       // one guide per line
+    binary,     // sorted codes, see guide_file.hpp
+    delta,      // blocked gaps of sorted codes, see delta_guide_file.hpp
+    elias_fano, // sorted codes with rank and select, see elias_fano.hpp
+    fuse_filter // approximate membership, see fuse_filter.hpp
+};
+
+enum class output_compression {
+    none,
+    gzip,       // -z
+    zstd        // -Z, see compressed_output.hpp
+};
+
+
+// Command line options for scan_stdin().
+struct scan_options {
+    // -r: output the reads each guide was found in
+    bool output_reads = false;
+
+    // -p: delta and varint compress the read lists of -r in memory
+    bool compress_postings = false;
+
+    // -t: number of threads scanning each window
+    int num_threads = 1;
+
+    // -b, -d, -e, -f: binary, delta, Elias-Fano or fuse filter output
+    output_format format = output_format::text;
+
+    // -z, -Z: compress the output, on num_threads worker threads
+    output_compression compression = output_compression::none;
+
+    // -i: read this FASTA file through mmap instead of stdin
+    std::string input_path;
+
+    // -o: write the output to this file, formatted in parallel, instead of stdout
+    std::string output_path;
+
+    // -w: keep guides with N bases as wildcard guides until output
+    bool lazy_wildcards = false;
+
+    // -n: at most this many N per 23-mer, PAM included
+    int max_N = default_max_N;
+
+    // -x turns this off: expand each guide with N into its ACGT variants
+    bool expand_N_variants = default_expand_N_variants;
+
+    // -H: back the scan results with transparent huge pages
+    bool huge_pages = false;
+
+    // -P: keep the guides as 5-byte 2-bit codes from scanning through sorting
+    bool packed_guides = false;
+
+    // -c: scan the -i file twice, first counting the guides and then placing
+    // them, instead of collecting and sorting them
+    bool count_first = false;
+
+    // -u: sort and deduplicate the results batch by batch while scanning
+    bool dedup_batches = false;
+
+    // -m: bytes of results to hold in memory before spilling them to
+    // sorted run files in spill_dir (-T); 0 keeps everything in memory
+    uint64_t memory_budget = 0;
+    std::string spill_dir = "/tmp";
+};
+
+void scan_stdin(const scan_options& options);
+void scan_stdin(bool output_reads);
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef CRISPR_SITES_DELTA_GUIDE_FILE_HPP
+#define CRISPR_SITES_DELTA_GUIDE_FILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "guide_file.hpp"
+#include "mapped_file.hpp"
+
+// Delta guide files
+// -----------------
+//
+// crispr_sites -d writes the sorted, deduplicated guide codes compactly as
+//
+//    delta_file_header
+//    num_blocks delta_block_index entries
+//    data_size bytes of blocks
+//
+// The codes are cut into blocks of block_codes codes.  The index holds the
+// first value of each block and the offset of the block in the data; the
+// block holds the gaps between each following value and the one before,
+// as LEB128 varints (7 bits per byte, high bit set on all but the last
+// byte of each gap).  Blocks decode independently, so a lookup binary
+// searches the index and decodes a single block.
+//
+// The values are the guide codes (see guide_file.hpp), except for sets
+// without N bases (GUIDE_FILE_N_EXPANDED), which store 2-bit codes: A, C,
+// G, T as 0 to 3.  Consecutive guides of a large set are then about as
+// many 2-bit codes apart as there are guides per 4^20, so most gaps of a
+// whole genome take 2 bytes rather than 8.
+
+constexpr char DELTA_FILE_MAGIC[8] = {'C', 'R', 'I', 'S', 'P', 'R', 'D', 'V'};
+constexpr uint32_t DELTA_FILE_VERSION = 1;
+
+// codes per block written by crispr_sites -d
+constexpr uint32_t DELTA_BLOCK_CODES = 128;
+
+struct delta_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t k;               // guides are k - 3 bases long
+    uint32_t bits_per_base;   // of the guide codes
+    uint32_t value_bits_per_base;   // of the stored values: 2 or bits_per_base
+    uint32_t flags;           // guide_file_header::flags
+    uint32_t block_codes;     // codes per block; the last block may be shorter
+    uint64_t count;           // number of codes
+    uint64_t num_blocks;
+    uint64_t data_size;       // bytes of blocks
+};
+
+static_assert(sizeof(delta_file_header) == 56, "delta_file_header must not be padded");
+
+struct delta_block_index {
+    uint64_t first;           // value of the block's first code
+    uint64_t offset;          // of the block in the data
+};
+
+
+// Builds a delta guide file from codes added in increasing order.  The
+// result is held in memory, which takes a fraction of the codes' size,
+// and written out in one go.
+class delta_guide_encoder {
+public:
+    delta_guide_encoder(uint32_t k, uint32_t bits_per_base, uint32_t flags,
+                        uint32_t block_codes = DELTA_BLOCK_CODES) : last(0) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, DELTA_FILE_MAGIC, sizeof(hdr.magic));
+        hdr.version = DELTA_FILE_VERSION;
+        hdr.k = k;
+        hdr.bits_per_base = bits_per_base;
+        hdr.value_bits_per_base = guide_value_bits_per_base(bits_per_base, flags);
+        hdr.flags = flags;
+        hdr.block_codes = std::max(1u, block_codes);
+    }
+
+    // Add the next code, in the order guide_file.hpp describes.
+    void add(int64_t code) {
+        const uint64_t value = guide_code_to_value(code, hdr.value_bits_per_base, hdr.k - 3);
+        if (hdr.count > 0 && value == last) {
+            return;
+        }
+        if (hdr.count % hdr.block_codes == 0) {
+            delta_block_index entry = {value, data.size()};
+            blocks.push_back(entry);
+        } else {
+            for (uint64_t gap = value - last;  ;  gap >>= 7) {
+                if (gap < 0x80) {
+                    data.push_back((uint8_t) gap);
+                    break;
+                }
+                data.push_back((uint8_t) (gap | 0x80));
+            }
+        }
+        last = value;
+        ++hdr.count;
+    }
+
+    // The header, index and data of the file, in this order.
+    const delta_file_header& header() {
+        hdr.num_blocks = blocks.size();
+        hdr.data_size = data.size();
+        return hdr;
+    }
+    const std::vector<delta_block_index>& index() const { return blocks; }
+    const std::vector<uint8_t>& block_data() const { return data; }
+
+private:
+    delta_file_header hdr;
+    uint64_t last;
+    std::vector<delta_block_index> blocks;
+    std::vector<uint8_t> data;
+};
+
+
+// A delta guide file mapped into memory.  Codes are decoded a block at a
+// time, either in order through a cursor or by seeking to a code.
+class delta_guide_file {
+public:
+    explicit delta_guide_file(const std::string& path) : file(path) {
+        if (file.size < sizeof(delta_file_header)) {
+            throw std::runtime_error(path + " is too short to be a delta guide file");
+        }
+        memcpy(&hdr, file.data, sizeof(hdr));
+        if (memcmp(hdr.magic, DELTA_FILE_MAGIC, sizeof(hdr.magic)) != 0) {
+            throw std::runtime_error(path + " is not a delta guide file");
+        }
+        if (hdr.version != DELTA_FILE_VERSION) {
+            throw std::runtime_error(path + " has unsupported delta guide file version " + std::to_string(hdr.version));
+        }
+        if (hdr.block_codes == 0 || hdr.k < 3 || hdr.num_blocks != (hdr.count + hdr.block_codes - 1) / hdr.block_codes) {
+            throw std::runtime_error(path + " has an inconsistent header");
+        }
+        const uint64_t index_size = hdr.num_blocks * sizeof(delta_block_index);
+        if ((file.size - sizeof(hdr)) < index_size || (file.size - sizeof(hdr) - index_size) < hdr.data_size) {
+            throw std::runtime_error(path + " is truncated");
+        }
+        blocks = reinterpret_cast<const delta_block_index*>(file.data + sizeof(hdr));
+        data = reinterpret_cast<const uint8_t*>(file.data + sizeof(hdr) + index_size);
+    }
+
+    const delta_file_header& header() const { return hdr; }
+    size_t size() const { return hdr.count; }
+    size_t num_blocks() const { return hdr.num_blocks; }
+
+    // Walks the codes in increasing order, decoding as it goes.
+    class cursor {
+    public:
+        explicit cursor(const delta_guide_file& file) : file(file) {
+            start_block(0);
+        }
+
+        bool valid() const { return block < file.hdr.num_blocks; }
+        int64_t code() const { return file.to_code(value); }
+
+        void next() {
+            if (++pos == file.block_size(block)) {
+                start_block(block + 1);
+                return;
+            }
+            uint64_t gap = 0;
+            for (int shift = 0;  ;  shift += 7) {
+                const uint8_t b = *p++;
+                gap |= uint64_t(b & 0x7f) << shift;
+                if (b < 0x80) {
+                    break;
+                }
+            }
+            value += gap;
+        }
+
+        // Move to the first code not less than code, in any direction.
+        void seek(int64_t code) {
+            const uint64_t target = file.to_value(code);
+            const delta_block_index* b = file.blocks;
+            const delta_block_index* e = file.blocks + file.hdr.num_blocks;
+            // the last block whose first value is at most target
+            const delta_block_index* it = std::upper_bound(b, e, target,
+                [](uint64_t v, const delta_block_index& entry) { return v < entry.first; });
+            start_block(it == b ? 0 : it - b - 1);
+            while (valid() && value < target) {
+                next();
+            }
+        }
+
+    private:
+        void start_block(uint64_t b) {
+            block = b;
+            pos = 0;
+            if (valid()) {
+                value = file.blocks[b].first;
+                p = file.data + file.blocks[b].offset;
+            }
+        }
+
+        const delta_guide_file& file;
+        uint64_t block;
+        uint64_t pos;       // of the current code in its block
+        uint64_t value;
+        const uint8_t* p;   // the next gap
+    };
+
+    bool contains(int64_t code) const {
+        cursor c(*this);
+        c.seek(code);
+        return c.valid() && c.code() == code;
+    }
+
+    // Call f(code) for all codes, in increasing order.
+    template <typename F>
+    void for_each(F f) const {
+        for (cursor c(*this);  c.valid();  c.next()) {
+            f(c.code());
+        }
+    }
+
+private:
+    uint64_t block_size(uint64_t b) const {
+        return b + 1 < hdr.num_blocks ? hdr.block_codes : hdr.count - b * hdr.block_codes;
+    }
+
+    int64_t to_code(uint64_t value) const {
+        return guide_code_from_value(value, hdr.value_bits_per_base, hdr.k - 3);
+    }
+
+    uint64_t to_value(int64_t code) const {
+        return guide_code_to_value_ceil(code, hdr.value_bits_per_base, hdr.k - 3);
+    }
+
+    mapped_file file;
+    delta_file_header hdr;
+    const delta_block_index* blocks;
+    const uint8_t* data;
+};
+
+#endif
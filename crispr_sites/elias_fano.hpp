@@ -0,0 +1,356 @@
+#ifndef CRISPR_SITES_ELIAS_FANO_HPP
+#define CRISPR_SITES_ELIAS_FANO_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "guide_file.hpp"
+#include "mapped_file.hpp"
+
+// Elias-Fano guide files
+// ----------------------
+//
+// crispr_sites -e writes the sorted, deduplicated guide codes as an
+// Elias-Fano sequence, which answers membership, rank and predecessor
+// queries straight from the mapped file in about 2 + log2(universe / count)
+// bits per guide.
+//
+// Each value is split into its low_bits low bits, stored as they are in a
+// packed array, and its high bits.  The high bits go into the upper bit
+// vector in unary: value i sets bit (value >> low_bits) + i, so the zeros
+// in the vector mark where one high value ends and the next begins.  Every
+// EF_SAMPLE-th one and every EF_SAMPLE-th zero have their positions
+// sampled, so select and rank only scan a few words of the vector.
+//
+//    elias_fano_header
+//    low_words words of low bits, value i at bit i * low_bits
+//    upper_words words of the upper bit vector
+//    ones_samples words: the position of one number j * EF_SAMPLE
+//    zeros_samples words: the position of zero number j * EF_SAMPLE
+//
+// As in delta guide files, sets without N (GUIDE_FILE_N_EXPANDED) store
+// the guides' 2-bit codes, and other sets their codes.
+
+constexpr char EF_FILE_MAGIC[8] = {'C', 'R', 'I', 'S', 'P', 'R', 'E', 'F'};
+constexpr uint32_t EF_FILE_VERSION = 1;
+
+// ones and zeros between position samples
+constexpr uint64_t EF_SAMPLE = 256;
+
+struct elias_fano_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t k;               // guides are k - 3 bases long
+    uint32_t bits_per_base;   // of the guide codes
+    uint32_t value_bits_per_base;   // of the stored values: 2 or bits_per_base
+    uint32_t flags;           // guide_file_header::flags
+    uint32_t low_bits;
+    uint64_t count;           // number of codes
+    uint64_t upper_bits;      // length of the upper bit vector
+    uint64_t low_words;
+    uint64_t upper_words;
+    uint64_t ones_samples;
+    uint64_t zeros_samples;
+};
+
+static_assert(sizeof(elias_fano_header) == 80, "elias_fano_header must not be padded");
+
+
+// Position of the r-th one bit of w, counting from 0 at the least
+// significant bit; w must have more than r ones.
+inline int select_in_word(uint64_t w, int r) {
+    int shift = 0;
+    for (int c;  r >= (c = __builtin_popcountll(w & 0xff));  r -= c) {
+        w >>= 8;
+        shift += 8;
+    }
+    for (;  r > 0;  --r) {
+        w &= w - 1;
+    }
+    return shift + __builtin_ctzll(w);
+}
+
+
+// Builds an Elias-Fano guide file from count codes added in increasing
+// order, in memory.
+class elias_fano_builder {
+public:
+    elias_fano_builder(uint32_t k, uint32_t bits_per_base, uint32_t flags, uint64_t count) : added(0), last(0) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, EF_FILE_MAGIC, sizeof(hdr.magic));
+        hdr.version = EF_FILE_VERSION;
+        hdr.k = k;
+        hdr.bits_per_base = bits_per_base;
+        hdr.value_bits_per_base = guide_value_bits_per_base(bits_per_base, flags);
+        hdr.flags = flags;
+        hdr.count = count;
+
+        // log2(universe / count) low bits balance the two parts; an empty set
+        // takes them all
+        const int universe_bits = hdr.value_bits_per_base * (k - 3);
+        int low_bits = 0;
+        while (low_bits < universe_bits && (count << (low_bits + 1)) <= (uint64_t(1) << universe_bits)) {
+            ++low_bits;
+        }
+        hdr.low_bits = low_bits;
+        hdr.upper_bits = count + (uint64_t(1) << (universe_bits - low_bits)) + 1;
+        // one word of padding, so that a value can always be read from two words
+        low.assign((count * low_bits + 63) / 64 + 1, 0);
+        upper.assign((hdr.upper_bits + 63) / 64, 0);
+    }
+
+    // Add the next of the count codes, in guide_file.hpp's order.
+    void add(int64_t code) {
+        const uint64_t value = guide_code_to_value(code, hdr.value_bits_per_base, hdr.k - 3);
+        if (added > 0 && value == last) {
+            return;
+        }
+        if (added == hdr.count) {
+            throw std::runtime_error("more codes than the Elias-Fano set was built for");
+        }
+        if (hdr.low_bits > 0) {
+            const uint64_t bit = added * hdr.low_bits;
+            const uint64_t low_value = value & ((uint64_t(1) << hdr.low_bits) - 1);
+            low[bit / 64] |= low_value << (bit % 64);
+            if (bit % 64 + hdr.low_bits > 64) {
+                low[bit / 64 + 1] |= low_value >> (64 - bit % 64);
+            }
+        }
+        const uint64_t pos = (value >> hdr.low_bits) + added;
+        upper[pos / 64] |= uint64_t(1) << (pos % 64);
+        last = value;
+        ++added;
+    }
+
+    // Sample the upper bit vector, once all codes are added.
+    void finish() {
+        if (added != hdr.count) {
+            throw std::runtime_error("fewer codes than the Elias-Fano set was built for");
+        }
+        // a word at a time: each sample is the next multiple of EF_SAMPLE
+        // ones or zeros, found within its word
+        uint64_t ones = 0;
+        uint64_t zeros = 0;
+        for (uint64_t w = 0;  w < upper.size();  ++w) {
+            const uint64_t valid = std::min((uint64_t) 64, hdr.upper_bits - 64 * w);
+            const uint64_t zero_bits = ~upper[w] & (valid == 64 ? ~uint64_t(0) : (uint64_t(1) << valid) - 1);
+            const uint64_t word_ones = __builtin_popcountll(upper[w]);
+            const uint64_t word_zeros = __builtin_popcountll(zero_bits);
+            for (uint64_t next = ones_samples.size() * EF_SAMPLE;  next < ones + word_ones;  next += EF_SAMPLE) {
+                ones_samples.push_back(64 * w + select_in_word(upper[w], next - ones));
+            }
+            for (uint64_t next = zeros_samples.size() * EF_SAMPLE;  next < zeros + word_zeros;  next += EF_SAMPLE) {
+                zeros_samples.push_back(64 * w + select_in_word(zero_bits, next - zeros));
+            }
+            ones += word_ones;
+            zeros += word_zeros;
+        }
+        hdr.low_words = low.size();
+        hdr.upper_words = upper.size();
+        hdr.ones_samples = ones_samples.size();
+        hdr.zeros_samples = zeros_samples.size();
+    }
+
+    // The header, low and upper bits and samples of the file, after finish().
+    const elias_fano_header& header() const { return hdr; }
+    const std::vector<uint64_t>& low_words() const { return low; }
+    const std::vector<uint64_t>& upper_words() const { return upper; }
+    const std::vector<uint64_t>& ones_sample_words() const { return ones_samples; }
+    const std::vector<uint64_t>& zeros_sample_words() const { return zeros_samples; }
+
+private:
+    elias_fano_header hdr;
+    uint64_t added;
+    uint64_t last;
+    std::vector<uint64_t> low;
+    std::vector<uint64_t> upper;
+    std::vector<uint64_t> ones_samples;
+    std::vector<uint64_t> zeros_samples;
+};
+
+
+// An Elias-Fano guide file mapped into memory.  Only the pages that
+// queries touch are read, so a set can be served in much less memory than
+// its size.
+class elias_fano_file {
+public:
+    explicit elias_fano_file(const std::string& path) : file(path) {
+        if (file.size < sizeof(elias_fano_header)) {
+            throw std::runtime_error(path + " is too short to be an Elias-Fano guide file");
+        }
+        memcpy(&hdr, file.data, sizeof(hdr));
+        if (memcmp(hdr.magic, EF_FILE_MAGIC, sizeof(hdr.magic)) != 0) {
+            throw std::runtime_error(path + " is not an Elias-Fano guide file");
+        }
+        if (hdr.version != EF_FILE_VERSION) {
+            throw std::runtime_error(path + " has unsupported Elias-Fano guide file version " + std::to_string(hdr.version));
+        }
+        if (hdr.k < 3 || hdr.low_bits >= 64 || hdr.upper_words != (hdr.upper_bits + 63) / 64
+            || hdr.low_words != (hdr.count * hdr.low_bits + 63) / 64 + 1
+            || hdr.ones_samples != (hdr.count + EF_SAMPLE - 1) / EF_SAMPLE
+            || hdr.zeros_samples != (hdr.upper_bits - hdr.count + EF_SAMPLE - 1) / EF_SAMPLE) {
+            throw std::runtime_error(path + " has an inconsistent header");
+        }
+        const uint64_t words = hdr.low_words + hdr.upper_words + hdr.ones_samples + hdr.zeros_samples;
+        if ((file.size - sizeof(hdr)) / sizeof(uint64_t) < words) {
+            throw std::runtime_error(path + " is truncated");
+        }
+        low = reinterpret_cast<const uint64_t*>(file.data + sizeof(hdr));
+        upper = low + hdr.low_words;
+        ones = upper + hdr.upper_words;
+        zeros = ones + hdr.ones_samples;
+    }
+
+    const elias_fano_header& header() const { return hdr; }
+    size_t size() const { return hdr.count; }
+
+    // The i-th smallest code.
+    int64_t select(uint64_t i) const {
+        return to_code(value(i));
+    }
+
+    // Number of codes less than code, which may contain N.
+    uint64_t rank(int64_t code) const {
+        return rank_value(to_value(code));
+    }
+
+    bool contains(int64_t code) const {
+        bool found = false;
+        const uint64_t v = to_value(code);
+        rank_value(v, &found);
+        return found && to_code(v) == code;
+    }
+
+    // Find the largest code not greater than code; false if there is none.
+    bool predecessor(int64_t code, int64_t& found) const {
+        bool equal = false;
+        const uint64_t v = to_value(code);
+        const uint64_t i = rank_value(v, &equal);
+        if (equal && to_code(v) == code) {
+            found = code;
+            return true;
+        }
+        if (i == 0) {
+            return false;
+        }
+        found = select(i - 1);
+        return true;
+    }
+
+    // Number of codes from lo up to but not including hi.
+    uint64_t count_range(int64_t lo, int64_t hi) const {
+        const uint64_t a = rank(lo);
+        const uint64_t b = rank(hi);
+        return b > a ? b - a : 0;
+    }
+
+    // Number of guides that start with the first prefix_bases bases of code,
+    // which may be anything from none to the whole guide.
+    uint64_t count_prefix(int64_t code, int prefix_bases) const {
+        const int guide_bases = hdr.k - 3;
+        if (prefix_bases < 0 || prefix_bases > guide_bases) {
+            throw std::invalid_argument("count_prefix needs from 0 to " + std::to_string(guide_bases)
+                                        + " prefix bases, not " + std::to_string(prefix_bases));
+        }
+        if (prefix_bases == 0) {
+            return hdr.count;
+        }
+        const int suffix_bases = guide_bases - prefix_bases;
+        if (hdr.value_bits_per_base != 2) {
+            const int shift = hdr.bits_per_base * suffix_bases;
+            return rank_value(((code >> shift) + 1) << shift) - rank_value(code >> shift << shift);
+        }
+        for (int i = suffix_bases;  i < guide_bases;  ++i) {
+            if (((code >> (3 * i)) & 7) == 3) {
+                return 0;   // no guide without N starts with N
+            }
+        }
+        const int shift = 2 * suffix_bases;
+        const uint64_t prefix = guide_code_to_2bit(code, guide_bases) >> shift;
+        return rank_value((prefix + 1) << shift) - rank_value(prefix << shift);
+    }
+
+private:
+    uint64_t value(uint64_t i) const {
+        return ((select1(i) - i) << hdr.low_bits) | low_value(i);
+    }
+
+    uint64_t low_value(uint64_t i) const {
+        if (hdr.low_bits == 0) {
+            return 0;
+        }
+        const uint64_t bit = i * hdr.low_bits;
+        uint64_t lo = low[bit / 64] >> (bit % 64);
+        if (bit % 64 + hdr.low_bits > 64) {
+            lo |= low[bit / 64 + 1] << (64 - bit % 64);
+        }
+        return lo & ((uint64_t(1) << hdr.low_bits) - 1);
+    }
+
+    // Number of values less than v; sets *found if v is one of them.
+    uint64_t rank_value(uint64_t v, bool* found = nullptr) const {
+        const uint64_t high = v >> hdr.low_bits;
+        if (high >= hdr.upper_bits - hdr.count) {
+            return hdr.count;
+        }
+        // values before high value number high end at zero number high - 1
+        uint64_t pos = high == 0 ? 0 : select0(high - 1) + 1;
+        uint64_t i = pos - high;
+        // walk the values with this high value, while they are less than v
+        const uint64_t v_low = v & ((uint64_t(1) << hdr.low_bits) - 1);
+        uint64_t i_low = 0;
+        while (((upper[pos / 64] >> (pos % 64)) & 1) && (i_low = low_value(i)) < v_low) {
+            ++i;
+            ++pos;
+        }
+        if (found) {
+            *found = ((upper[pos / 64] >> (pos % 64)) & 1) && i_low == v_low;
+        }
+        return i;
+    }
+
+    // Position of one number i in the upper bit vector.
+    uint64_t select1(uint64_t i) const {
+        uint64_t pos = ones[i / EF_SAMPLE];
+        uint64_t r = i % EF_SAMPLE;
+        uint64_t word = pos / 64;
+        uint64_t w = upper[word] & (~uint64_t(0) << (pos % 64));
+        for (uint64_t c;  r >= (c = __builtin_popcountll(w));  r -= c) {
+            w = upper[++word];
+        }
+        return word * 64 + select_in_word(w, r);
+    }
+
+    // Position of zero number i in the upper bit vector.
+    uint64_t select0(uint64_t i) const {
+        uint64_t pos = zeros[i / EF_SAMPLE];
+        uint64_t r = i % EF_SAMPLE;
+        uint64_t word = pos / 64;
+        uint64_t w = ~upper[word] & (~uint64_t(0) << (pos % 64));
+        for (uint64_t c;  r >= (c = __builtin_popcountll(w));  r -= c) {
+            w = ~upper[++word];
+        }
+        return word * 64 + select_in_word(w, r);
+    }
+
+    int64_t to_code(uint64_t v) const {
+        return guide_code_from_value(v, hdr.value_bits_per_base, hdr.k - 3);
+    }
+
+    uint64_t to_value(int64_t code) const {
+        return guide_code_to_value_ceil(code, hdr.value_bits_per_base, hdr.k - 3);
+    }
+
+    mapped_file file;
+    elias_fano_header hdr;
+    const uint64_t* low;
+    const uint64_t* upper;
+    const uint64_t* ones;
+    const uint64_t* zeros;
+};
+
+#endif
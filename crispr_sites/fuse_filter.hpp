@@ -0,0 +1,367 @@
+#ifndef CRISPR_SITES_FUSE_FILTER_HPP
+#define CRISPR_SITES_FUSE_FILTER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "guide_file.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+
+// Binary fuse filter files
+// ------------------------
+//
+// crispr_sites -f writes a binary fuse filter of the distinct guide codes
+// (Graf and Lemire, "Binary Fuse Filters: Fast and Smaller Than Xor
+// Filters", 2022): about 9 bits per guide, which answer "this guide is
+// certainly not in the set" for all but 1 in 256 guides outside it, and
+// never for a guide in it.
+//
+// Each code hashes to three fingerprint slots in consecutive segments of
+// the slot array, and to an 8-bit fingerprint; the code may be in the set
+// only if the fingerprint equals the xor of its three slots.  Building the
+// filter peels the codes off the slots one at a time, and then fills the
+// slots in reverse order so that each code's xor comes out right.
+//
+// The sorted codes are cut into shards of FUSE_SHARD_KEYS codes, each its
+// own filter covering the codes from its first code up to the next
+// shard's.  Shards are built in parallel, and a lookup binary searches the
+// small shard table before probing a single shard.
+//
+//    fuse_filter_header
+//    num_shards fuse_filter_shard entries
+//    fingerprints_size bytes of fingerprints, shard by shard
+
+constexpr char FUSE_FILE_MAGIC[8] = {'C', 'R', 'I', 'S', 'P', 'R', 'F', 'F'};
+constexpr uint32_t FUSE_FILE_VERSION = 1;
+
+// codes per shard; building a shard takes about 30 bytes per code
+constexpr size_t FUSE_SHARD_KEYS = 1 << 20;
+
+struct fuse_filter_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t k;               // guides are k - 3 bases long
+    uint32_t bits_per_base;
+    uint32_t flags;           // guide_file_header::flags
+    uint32_t fingerprint_bits;
+    uint32_t reserved;
+    uint64_t count;           // number of codes
+    uint64_t num_shards;
+    uint64_t fingerprints_size;
+};
+
+static_assert(sizeof(fuse_filter_header) == 56, "fuse_filter_header must not be padded");
+
+struct fuse_filter_shard {
+    int64_t first;            // the shard's smallest code
+    uint64_t seed;
+    uint64_t offset;          // of the shard's fingerprints
+    uint32_t segment_length;  // a power of two
+    uint32_t segment_count;   // the slots are segment_count + 2 segments
+};
+
+static_assert(sizeof(fuse_filter_shard) == 32, "fuse_filter_shard must not be padded");
+
+
+inline uint64_t fuse_hash(int64_t code, uint64_t seed) {
+    // the murmur3 finalizer
+    uint64_t h = code + seed;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint8_t fuse_fingerprint(uint64_t hash) {
+    return (uint8_t) (hash ^ (hash >> 32));
+}
+
+// The three slots of hash in a shard.
+inline void fuse_slots(const fuse_filter_shard& shard, uint64_t hash, uint64_t slots[3]) {
+    const uint64_t segment_count_length = uint64_t(shard.segment_count) * shard.segment_length;
+    const uint64_t mask = shard.segment_length - 1;
+    slots[0] = (uint64_t) (((unsigned __int128) hash * segment_count_length) >> 64);
+    slots[1] = (slots[0] + shard.segment_length) ^ ((hash >> 18) & mask);
+    slots[2] = (slots[0] + 2 * shard.segment_length) ^ (hash & mask);
+}
+
+
+// Builds a binary fuse filter from codes added in increasing order.  Full
+// shards are built num_threads at a time as codes come in; the filter is
+// held in memory and written out in one go.
+class fuse_filter_builder {
+public:
+    fuse_filter_builder(uint32_t k, uint32_t bits_per_base, uint32_t flags, int num_threads)
+        : num_threads(std::max(1, num_threads)), last(0) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, FUSE_FILE_MAGIC, sizeof(hdr.magic));
+        hdr.version = FUSE_FILE_VERSION;
+        hdr.k = k;
+        hdr.bits_per_base = bits_per_base;
+        hdr.flags = flags;
+        hdr.fingerprint_bits = 8;
+    }
+
+    // Add the next code, in guide_file.hpp's order; a full round of
+    // pending codes is built into shards right away.
+    void add(int64_t code) {
+        if (hdr.count > 0 && code == last) {
+            return;
+        }
+        pending.push_back(code);
+        last = code;
+        ++hdr.count;
+        if (pending.size() == num_threads * FUSE_SHARD_KEYS) {
+            build_pending();
+        }
+    }
+
+    // Build the last shards, once all codes are added.
+    void finish() {
+        build_pending();
+        hdr.num_shards = table.size();
+        hdr.fingerprints_size = fingerprints.size();
+    }
+
+    // The header, shards and fingerprints of the file, after finish().
+    const fuse_filter_header& header() const { return hdr; }
+    const std::vector<fuse_filter_shard>& shards() const { return table; }
+    const std::vector<uint8_t>& fingerprint_bytes() const { return fingerprints; }
+
+private:
+    // Build the pending codes into shards, one thread per shard.
+    void build_pending() {
+        if (pending.empty()) {
+            return;
+        }
+        const size_t num_shards = (pending.size() + FUSE_SHARD_KEYS - 1) / FUSE_SHARD_KEYS;
+        std::vector<fuse_filter_shard> built(num_shards);
+        std::vector<std::vector<uint8_t> > slots(num_shards);
+        std::vector<std::string> errors(num_shards);
+        run_in_parallel((int) num_shards, [&](int s) {
+            const size_t start = s * FUSE_SHARD_KEYS;
+            const size_t n = std::min(FUSE_SHARD_KEYS, pending.size() - start);
+            try {
+                build_shard(pending.data() + start, n, table.size() + s, built[s], slots[s]);
+            } catch (const std::exception& e) {
+                errors[s] = e.what();
+            }
+        });
+        for (size_t s = 0;  s < num_shards;  ++s) {
+            if (!errors[s].empty()) {
+                throw std::runtime_error(errors[s]);
+            }
+            built[s].offset = fingerprints.size();
+            table.push_back(built[s]);
+            fingerprints.insert(fingerprints.end(), slots[s].begin(), slots[s].end());
+        }
+        pending.clear();
+    }
+
+    // Build the filter of the n distinct keys of shard number index.
+    static void build_shard(const int64_t* keys, size_t n, uint64_t index,
+                            fuse_filter_shard& shard, std::vector<uint8_t>& slots) {
+        // sizes as in the reference implementation, for 3 slots per key
+        shard.first = keys[0];
+        uint32_t segment_length = 1u << (int) floor(log((double) n) / log(3.33) + 2.25);
+        shard.segment_length = std::min(segment_length, 1u << 18);
+        const double size_factor = n <= 1 ? 0 : std::max(1.125, 0.875 + 0.25 * log(1000000.0) / log((double) n));
+        const uint64_t capacity = (uint64_t) round(n * size_factor);
+        const int64_t segments = (capacity + shard.segment_length - 1) / shard.segment_length;
+        shard.segment_count = (uint32_t) std::max((int64_t) 1, segments - 2);
+        const size_t slot_count = size_t(shard.segment_count + 2) * shard.segment_length;
+
+        // per slot, the number of keys on it times 4 plus the xor of which
+        // of their slots it is, and the xor of their hashes
+        std::vector<uint8_t> slot_keys(slot_count);
+        std::vector<uint64_t> slot_hashes(slot_count);
+        std::vector<uint32_t> alone(slot_count);
+        std::vector<uint64_t> peeled_hashes(n);
+        std::vector<uint8_t> peeled_slots(n);
+
+        // the seeds of successive attempts, from splitmix64
+        uint64_t seed_state = index * 0x9e3779b97f4a7c15ULL;
+        for (int attempt = 0;  attempt < 100;  ++attempt) {
+            uint64_t z = (seed_state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            shard.seed = z ^ (z >> 31);
+
+            std::fill(slot_keys.begin(), slot_keys.end(), 0);
+            std::fill(slot_hashes.begin(), slot_hashes.end(), 0);
+            bool overflow = false;
+            for (size_t i = 0;  i < n;  ++i) {
+                const uint64_t hash = fuse_hash(keys[i], shard.seed);
+                uint64_t h[3];
+                fuse_slots(shard, hash, h);
+                for (int j = 0;  j < 3;  ++j) {
+                    overflow |= slot_keys[h[j]] >= 0xfc;
+                    slot_keys[h[j]] += 4;
+                    slot_keys[h[j]] ^= j;
+                    slot_hashes[h[j]] ^= hash;
+                }
+            }
+            if (overflow) {
+                continue;
+            }
+
+            // peel keys off the slots they are alone on
+            size_t queued = 0;
+            for (size_t i = 0;  i < slot_count;  ++i) {
+                if ((slot_keys[i] >> 2) == 1) {
+                    alone[queued++] = i;
+                }
+            }
+            size_t peeled = 0;
+            while (queued > 0) {
+                const uint32_t slot = alone[--queued];
+                if ((slot_keys[slot] >> 2) != 1) {
+                    continue;
+                }
+                const uint64_t hash = slot_hashes[slot];
+                const int found = slot_keys[slot] & 3;
+                peeled_hashes[peeled] = hash;
+                peeled_slots[peeled] = found;
+                ++peeled;
+                uint64_t h[3];
+                fuse_slots(shard, hash, h);
+                for (int j = 0;  j < 3;  ++j) {
+                    if (j == found) {
+                        continue;
+                    }
+                    if ((slot_keys[h[j]] >> 2) == 2) {
+                        alone[queued++] = h[j];
+                    }
+                    slot_keys[h[j]] -= 4;
+                    slot_keys[h[j]] ^= j;
+                    slot_hashes[h[j]] ^= hash;
+                }
+            }
+            if (peeled < n) {
+                continue;
+            }
+
+            // fill the slots in reverse peeling order
+            slots.assign(slot_count, 0);
+            for (size_t i = n;  i-- > 0; ) {
+                uint64_t h[3];
+                fuse_slots(shard, peeled_hashes[i], h);
+                const int found = peeled_slots[i];
+                slots[h[found]] = fuse_fingerprint(peeled_hashes[i]) ^ slots[h[(found + 1) % 3]] ^ slots[h[(found + 2) % 3]];
+            }
+            return;
+        }
+        throw std::runtime_error("cannot build a binary fuse filter; are the codes distinct?");
+    }
+
+    const size_t num_threads;
+    fuse_filter_header hdr;
+    int64_t last;
+    std::vector<int64_t> pending;
+    std::vector<fuse_filter_shard> table;
+    std::vector<uint8_t> fingerprints;
+};
+
+
+// A binary fuse filter file mapped into memory.
+class fuse_filter_file {
+public:
+    explicit fuse_filter_file(const std::string& path) : file(path) {
+        if (file.size < sizeof(fuse_filter_header)) {
+            throw std::runtime_error(path + " is too short to be a fuse filter file");
+        }
+        memcpy(&hdr, file.data, sizeof(hdr));
+        if (memcmp(hdr.magic, FUSE_FILE_MAGIC, sizeof(hdr.magic)) != 0) {
+            throw std::runtime_error(path + " is not a fuse filter file");
+        }
+        if (hdr.version != FUSE_FILE_VERSION) {
+            throw std::runtime_error(path + " has unsupported fuse filter file version " + std::to_string(hdr.version));
+        }
+        if (hdr.fingerprint_bits != 8 || hdr.num_shards != (hdr.count + FUSE_SHARD_KEYS - 1) / FUSE_SHARD_KEYS) {
+            throw std::runtime_error(path + " has an inconsistent header");
+        }
+        const uint64_t table_size = hdr.num_shards * sizeof(fuse_filter_shard);
+        if ((file.size - sizeof(hdr)) < table_size || (file.size - sizeof(hdr) - table_size) < hdr.fingerprints_size) {
+            throw std::runtime_error(path + " is truncated");
+        }
+        table = reinterpret_cast<const fuse_filter_shard*>(file.data + sizeof(hdr));
+        fingerprints = reinterpret_cast<const uint8_t*>(file.data + sizeof(hdr) + table_size);
+        for (uint64_t s = 0;  s < hdr.num_shards;  ++s) {
+            const uint64_t slots = uint64_t(table[s].segment_count + 2) * table[s].segment_length;
+            if (table[s].segment_length == 0 || (table[s].segment_length & (table[s].segment_length - 1))
+                || table[s].offset > hdr.fingerprints_size || hdr.fingerprints_size - table[s].offset < slots) {
+                throw std::runtime_error(path + " has an inconsistent shard table");
+            }
+        }
+    }
+
+    const fuse_filter_header& header() const { return hdr; }
+    size_t size() const { return hdr.count; }
+
+    // False if code is certainly not in the set; true if it is, or for
+    // about 1 in 256 codes that are not.
+    bool maybe_contains(int64_t code) const {
+        if (hdr.num_shards == 0) {
+            return false;
+        }
+        const fuse_filter_shard& shard = shard_of(code);
+        const uint64_t hash = fuse_hash(code, shard.seed);
+        uint64_t h[3];
+        fuse_slots(shard, hash, h);
+        const uint8_t* slots = fingerprints + shard.offset;
+        return (fuse_fingerprint(hash) ^ slots[h[0]] ^ slots[h[1]] ^ slots[h[2]]) == 0;
+    }
+
+    // maybe[i] = maybe_contains(codes[i]) for i < n.  The slots of a batch
+    // are prefetched before any of them is read, so that their cache misses
+    // overlap.
+    void maybe_contains(const int64_t* codes, size_t n, bool* maybe) const {
+        constexpr size_t BATCH = 64;
+        const uint8_t* probes[BATCH][3];
+        uint8_t expected[BATCH];
+        for (size_t start = 0;  start < n;  start += BATCH) {
+            const size_t len = std::min(BATCH, n - start);
+            if (hdr.num_shards == 0) {
+                std::fill(maybe + start, maybe + start + len, false);
+                continue;
+            }
+            for (size_t i = 0;  i < len;  ++i) {
+                const fuse_filter_shard& shard = shard_of(codes[start + i]);
+                const uint64_t hash = fuse_hash(codes[start + i], shard.seed);
+                uint64_t h[3];
+                fuse_slots(shard, hash, h);
+                expected[i] = fuse_fingerprint(hash);
+                for (int j = 0;  j < 3;  ++j) {
+                    probes[i][j] = fingerprints + shard.offset + h[j];
+                    __builtin_prefetch(probes[i][j]);
+                }
+            }
+            for (size_t i = 0;  i < len;  ++i) {
+                maybe[start + i] = (expected[i] ^ *probes[i][0] ^ *probes[i][1] ^ *probes[i][2]) == 0;
+            }
+        }
+    }
+
+private:
+    // The shard whose codes would include code.
+    const fuse_filter_shard& shard_of(int64_t code) const {
+        const fuse_filter_shard* it = std::upper_bound(table, table + hdr.num_shards, code,
+            [](int64_t c, const fuse_filter_shard& shard) { return c < shard.first; });
+        return it == table ? table[0] : *(it - 1);
+    }
+
+    mapped_file file;
+    fuse_filter_header hdr;
+    const fuse_filter_shard* table;
+    const uint8_t* fingerprints;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef CRISPR_SITES_GUIDE_FILE_HPP
+#define CRISPR_SITES_GUIDE_FILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "mapped_file.hpp"
+
+// Binary guide files
+// ------------------
+//
+// crispr_sites -b writes the sorted, deduplicated guide codes as
+//
+//    guide_file_header
+//    count codes, each a little-endian integer of record_size bytes
+//
+// The codes are the ones produced by encode<k - 3>: bits_per_base bits per
+// base, first base in the most significant bits, so sorting the codes
+// sorts the guides lexicographically.  guide_file below maps such a file
+// into memory and presents the codes as a sorted array.
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "guide files are little-endian and are mapped as is");
+
+constexpr char GUIDE_FILE_MAGIC[8] = {'C', 'R', 'I', 'S', 'P', 'R', 'G', 'D'};
+constexpr uint32_t GUIDE_FILE_VERSION = 1;
+
+// guide_file_header::flags
+constexpr uint32_t GUIDE_FILE_N_EXPANDED = 1;  // codes contain no N bases
+constexpr uint32_t GUIDE_FILE_READ_SITES = 2;  // records are read_sites (spill runs only)
+
+struct guide_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t k;               // guides are k - 3 bases long
+    uint32_t bits_per_base;
+    uint32_t record_size;     // bytes per code
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t count;           // number of codes
+};
+
+static_assert(sizeof(guide_file_header) == 40, "guide_file_header must not be padded");
+
+
+inline guide_file_header make_guide_file_header(uint32_t k, uint32_t bits_per_base,
+                                                uint32_t flags, uint64_t count) {
+    guide_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GUIDE_FILE_MAGIC, sizeof(header.magic));
+    header.version = GUIDE_FILE_VERSION;
+    header.k = k;
+    header.bits_per_base = bits_per_base;
+    header.record_size = sizeof(int64_t);
+    header.flags = flags;
+    header.count = count;
+    return header;
+}
+
+
+// 2-bit value of a guide code without N, and back, four bases at a time
+// by table lookup: A, C, G, T are 0 to 3 rather than their guide codes 1,
+// 2, 4, 5 (see bitcode_for_base in crispr_sites.cpp).  The compact formats
+// (delta_guide_file.hpp, elias_fano.hpp) store sets without N this way.
+struct guide_2bit_tables {
+    uint8_t to_2bit[1 << 12];
+    uint16_t from_2bit[1 << 8];
+
+    guide_2bit_tables() {
+        for (int code = 0;  code < (1 << 12);  ++code) {
+            int value = 0;
+            for (int i = 0;  i < 4;  ++i) {
+                const int base = (code >> (3 * i)) & 7;
+                value |= ((base - 1 - (base >> 2)) & 3) << (2 * i);
+            }
+            to_2bit[code] = value;
+        }
+        for (int value = 0;  value < (1 << 8);  ++value) {
+            int code = 0;
+            for (int i = 0;  i < 4;  ++i) {
+                const int base = (value >> (2 * i)) & 3;
+                code |= (base + 1 + (base >> 1)) << (3 * i);
+            }
+            from_2bit[value] = code;
+        }
+    }
+
+    static const guide_2bit_tables& get() {
+        static const guide_2bit_tables tables;
+        return tables;
+    }
+};
+
+inline uint64_t guide_code_to_2bit(int64_t code, int bases) {
+    const guide_2bit_tables& tables = guide_2bit_tables::get();
+    uint64_t value = 0;
+    for (int i = 0;  i < bases;  i += 4) {
+        value |= uint64_t(tables.to_2bit[(code >> (3 * i)) & 0xfff]) << (2 * i);
+    }
+    // drop what the last lookup made of the bits past the last base
+    return value & ((uint64_t(1) << (2 * bases)) - 1);
+}
+
+inline int64_t guide_code_from_2bit(uint64_t value, int bases) {
+    const guide_2bit_tables& tables = guide_2bit_tables::get();
+    int64_t code = 0;
+    for (int i = 0;  i < bases;  i += 4) {
+        code |= int64_t(tables.from_2bit[(value >> (2 * i)) & 0xff]) << (3 * i);
+    }
+    // drop what the last lookup made of the bits past the last base
+    return code & ((int64_t(1) << (3 * bases)) - 1);
+}
+
+
+// The 2-bit value of the first guide without N not less than code, which
+// may contain N: the most significant N becomes G (N sorts between C and
+// G), and the bases after it A.
+inline uint64_t guide_code_to_2bit_ceil(int64_t code, int bases) {
+    for (int i = bases - 1;  i >= 0;  --i) {
+        if (((code >> (3 * i)) & 7) == 3) {
+            code = (code >> (3 * (i + 1)) << (3 * (i + 1))) | (int64_t(4) << (3 * i));
+            for (int j = 0;  j < i;  ++j) {
+                code |= int64_t(1) << (3 * j);
+            }
+            break;
+        }
+    }
+    return guide_code_to_2bit(code, bases);
+}
+
+
+// The compact formats store the codes of a set without N as 2-bit values
+// and any other set's codes as they are.  Their builders take the sorted
+// codes one add() at a time: codes must not decrease, and a repeat of the
+// last code is ignored, so that crispr_sites can pass on its sorted
+// results as they are.
+inline uint32_t guide_value_bits_per_base(uint32_t bits_per_base, uint32_t flags) {
+    return (bits_per_base == 3 && (flags & GUIDE_FILE_N_EXPANDED)) ? 2 : bits_per_base;
+}
+
+inline uint64_t guide_code_to_value(int64_t code, uint32_t value_bits_per_base, int bases) {
+    return value_bits_per_base == 2 ? guide_code_to_2bit(code, bases) : code;
+}
+
+// the value of the first code without N not less than code, for queries
+inline uint64_t guide_code_to_value_ceil(int64_t code, uint32_t value_bits_per_base, int bases) {
+    return value_bits_per_base == 2 ? guide_code_to_2bit_ceil(code, bases) : code;
+}
+
+inline int64_t guide_code_from_value(uint64_t value, uint32_t value_bits_per_base, int bases) {
+    return value_bits_per_base == 2 ? guide_code_from_2bit(value, bases) : (int64_t) value;
+}
+
+
+// A guide file mapped into memory, as a sorted array of codes.
+class guide_file {
+public:
+    explicit guide_file(const std::string& path) : file(path) {
+        if (file.size < sizeof(guide_file_header)) {
+            throw std::runtime_error(path + " is too short to be a guide file");
+        }
+        memcpy(&hdr, file.data, sizeof(hdr));
+        if (memcmp(hdr.magic, GUIDE_FILE_MAGIC, sizeof(hdr.magic)) != 0) {
+            throw std::runtime_error(path + " is not a guide file");
+        }
+        if (hdr.version != GUIDE_FILE_VERSION) {
+            throw std::runtime_error(path + " has unsupported guide file version " + std::to_string(hdr.version));
+        }
+        if (hdr.record_size != sizeof(int64_t)) {
+            throw std::runtime_error(path + " has unsupported record size " + std::to_string(hdr.record_size));
+        }
+        if ((file.size - sizeof(hdr)) / hdr.record_size < hdr.count) {
+            throw std::runtime_error(path + " is truncated");
+        }
+        codes = reinterpret_cast<const int64_t*>(file.data + sizeof(hdr));
+    }
+
+    const guide_file_header& header() const { return hdr; }
+    size_t size() const { return hdr.count; }
+    const int64_t* begin() const { return codes; }
+    const int64_t* end() const { return codes + hdr.count; }
+    int64_t operator[](size_t i) const { return codes[i]; }
+
+    bool contains(int64_t code) const {
+        return std::binary_search(begin(), end(), code);
+    }
+
+private:
+    mapped_file file;
+    guide_file_header hdr;
+    const int64_t* codes;
+};
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef CRISPR_SITES_GZIP_INPUT_HPP
+#define CRISPR_SITES_GZIP_INPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <zlib.h>
+
+// gzip and BGZF input
+// -------------------
+//
+// BGZF (the blocked gzip of samtools and bgzip) is a series of gzip members
+// of at most 64 KB each, and every member's header records its compressed
+// size in a "BC" extra field.  The blocks of a BGZF file can therefore be
+// found without decompressing anything, and inflated independently in
+// parallel.  Any other gzip file has to be inflated as one stream.
+
+// The gzip header fields we need to look at.
+constexpr size_t GZIP_HEADER_SIZE = 12;     // up to and including XLEN
+constexpr size_t GZIP_TRAILER_SIZE = 8;     // CRC32 and ISIZE
+constexpr unsigned char GZIP_ID1 = 0x1f;
+constexpr unsigned char GZIP_ID2 = 0x8b;
+constexpr unsigned char GZIP_CM_DEFLATE = 8;
+constexpr unsigned char GZIP_FEXTRA = 4;
+
+// A BGZF block decompresses to at most this many bytes.
+constexpr size_t BGZF_MAX_BLOCK_SIZE = 64 * 1024;
+
+
+inline uint32_t read_le16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+inline uint32_t read_le32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+inline bool is_gzip(const char* data, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    return len >= 2 && p[0] == GZIP_ID1 && p[1] == GZIP_ID2;
+}
+
+
+// The total size of the BGZF block at data, 0 if len is too short to
+// tell, or -1 if data does not start with a BGZF block header.
+inline long bgzf_block_size(const char* data, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    if (len < GZIP_HEADER_SIZE) {
+        return 0;
+    }
+    if (p[0] != GZIP_ID1 || p[1] != GZIP_ID2 || p[2] != GZIP_CM_DEFLATE || !(p[3] & GZIP_FEXTRA)) {
+        return -1;
+    }
+    const size_t xlen = read_le16(p + 10);
+    if (len < GZIP_HEADER_SIZE + xlen) {
+        return 0;
+    }
+    // look for the BC subfield among the extra subfields
+    for (size_t pos = GZIP_HEADER_SIZE;  pos + 4 <= GZIP_HEADER_SIZE + xlen; ) {
+        const size_t slen = read_le16(p + pos + 2);
+        if (p[pos] == 'B' && p[pos + 1] == 'C' && slen == 2 && pos + 6 <= GZIP_HEADER_SIZE + xlen) {
+            const long size = read_le16(p + pos + 4) + 1;
+            if ((size_t) size < GZIP_HEADER_SIZE + xlen + GZIP_TRAILER_SIZE) {
+                return -1;
+            }
+            return size;
+        }
+        pos += 4 + slen;
+    }
+    return -1;
+}
+
+
+// The uncompressed size of a complete BGZF block, from its trailer.
+inline uint32_t bgzf_block_isize(const char* block, size_t size) {
+    return read_le32(reinterpret_cast<const unsigned char*>(block) + size - 4);
+}
+
+
+// Inflate one complete BGZF block of size bytes into out, which must have
+// room for its bgzf_block_isize() bytes.  strm must have been set up with
+// inflateInit2(strm, -MAX_WBITS).  Throws on corrupt data.
+inline void bgzf_inflate_block(z_stream& strm, const char* block, size_t size, char* out) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(block);
+    const size_t data_start = GZIP_HEADER_SIZE + read_le16(p + 10);
+    const uint32_t expected_crc = read_le32(p + size - 8);
+    const uint32_t isize = read_le32(p + size - 4);
+
+    if (inflateReset(&strm) != Z_OK) {
+        throw std::runtime_error("inflateReset failed");
+    }
+    strm.next_in = const_cast<Bytef*>(p + data_start);
+    strm.avail_in = size - data_start - GZIP_TRAILER_SIZE;
+    strm.next_out = reinterpret_cast<Bytef*>(out);
+    strm.avail_out = isize;
+    const int ret = inflate(&strm, Z_FINISH);
+    if (ret != Z_STREAM_END || strm.avail_out != 0) {
+        throw std::runtime_error("corrupt BGZF block in input");
+    }
+    if (crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(out), isize) != expected_crc) {
+        throw std::runtime_error("CRC error in BGZF block in input");
+    }
+}
+
+
+// A raw deflate z_stream for bgzf_inflate_block.
+class bgzf_inflater {
+public:
+    bgzf_inflater() {
+        strm.zalloc = Z_NULL;
+        strm.zfree = Z_NULL;
+        strm.opaque = Z_NULL;
+        strm.next_in = Z_NULL;
+        strm.avail_in = 0;
+        if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+            throw std::runtime_error("inflateInit2 failed");
+        }
+    }
+
+    ~bgzf_inflater() {
+        inflateEnd(&strm);
+    }
+
+    bgzf_inflater(const bgzf_inflater&) = delete;
+    bgzf_inflater& operator=(const bgzf_inflater&) = delete;
+
+    void inflate_block(const char* block, size_t size, char* out) {
+        bgzf_inflate_block(strm, block, size, out);
+    }
+
+private:
+    z_stream strm;
+};
+
+
+// Streaming inflate of a gzip file, which may consist of several members.
+class gzip_inflater {
+public:
+    gzip_inflater() : in_member(false) {
+        strm.zalloc = Z_NULL;
+        strm.zfree = Z_NULL;
+        strm.opaque = Z_NULL;
+        strm.next_in = Z_NULL;
+        strm.avail_in = 0;
+        if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+            throw std::runtime_error("inflateInit2 failed");
+        }
+    }
+
+    ~gzip_inflater() {
+        inflateEnd(&strm);
+    }
+
+    gzip_inflater(const gzip_inflater&) = delete;
+    gzip_inflater& operator=(const gzip_inflater&) = delete;
+
+    // Inflate from in[0 ... in_len) into out[0 ... out_len) until either
+    // runs out.  Advances in and in_len past the input consumed, and
+    // returns the number of bytes written to out.  Throws on corrupt data.
+    size_t inflate_some(const char*& in, size_t& in_len, char* out, size_t out_len) {
+        strm.next_out = reinterpret_cast<Bytef*>(out);
+        strm.avail_out = out_len;
+        while (in_len > 0 && strm.avail_out > 0) {
+            if (!in_member && *in == 0) {
+                // gzip tolerates zero padding after the last member
+                ++in;
+                --in_len;
+                continue;
+            }
+            strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+            strm.avail_in = in_len;
+            const int ret = inflate(&strm, Z_NO_FLUSH);
+            const size_t consumed = in_len - strm.avail_in;
+            in += consumed;
+            in_len -= consumed;
+            if (ret == Z_STREAM_END) {
+                // the next member, if any, starts with a new header
+                in_member = false;
+                if (inflateReset(&strm) != Z_OK) {
+                    throw std::runtime_error("inflateReset failed");
+                }
+            } else if (ret == Z_OK) {
+                in_member = true;
+            } else if (ret == Z_BUF_ERROR) {
+                // no progress possible; only happens when out is full
+                in_member = true;
+                break;
+            } else {
+                throw std::runtime_error(std::string("corrupt gzip input: ") + (strm.msg ? strm.msg : "unknown error"));
+            }
+        }
+        return out_len - strm.avail_out;
+    }
+
+    // Call at the end of input: throws if it stopped in the middle of a member.
+    void finish() const {
+        if (in_member) {
+            throw std::runtime_error("unexpected end of gzip input");
+        }
+    }
+
+private:
+    z_stream strm;
+    bool in_member;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef CRISPR_SITES_MAPPED_FILE_HPP
+#define CRISPR_SITES_MAPPED_FILE_HPP
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read-only memory mapping of a whole file.
+class mapped_file {
+public:
+    explicit mapped_file(const std::string& path) : data(nullptr), size(0) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("cannot open " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            const int error = errno;
+            close(fd);
+            throw std::runtime_error("cannot stat " + path + ": " + strerror(error));
+        }
+        size = st.st_size;
+        if (size > 0) {
+            void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                const int error = errno;
+                close(fd);
+                throw std::runtime_error("cannot mmap " + path + ": " + strerror(error));
+            }
+            data = static_cast<const char*>(p);
+        }
+        close(fd);
+    }
+
+    ~mapped_file() {
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const char* data;
+    size_t size;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CRISPR_SITES_MAPPED_OUTPUT_HPP
+#define CRISPR_SITES_MAPPED_OUTPUT_HPP
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// An output file of a size known in advance, created or truncated, sized
+// and mapped for writing, so that several threads can fill disjoint parts
+// of it at once.  The contents reach the file when it is unmapped.
+class mapped_output {
+public:
+    mapped_output(const std::string& path, size_t size) : data(nullptr), size(size) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (fd == -1) {
+            throw std::runtime_error("cannot create " + path + ": " + strerror(errno));
+        }
+        if (ftruncate(fd, size) == -1) {
+            const int error = errno;
+            close(fd);
+            throw std::runtime_error("cannot size " + path + ": " + strerror(error));
+        }
+        if (size > 0) {
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                const int error = errno;
+                close(fd);
+                throw std::runtime_error("cannot mmap " + path + ": " + strerror(error));
+            }
+            data = static_cast<char*>(p);
+        }
+    }
+
+    ~mapped_output() {
+        if (data) {
+            munmap(data, size);
+        }
+        close(fd);
+    }
+
+    mapped_output(const mapped_output&) = delete;
+    mapped_output& operator=(const mapped_output&) = delete;
+
+    char* data;
+    size_t size;
+
+private:
+    int fd;
+};
+
+#endif
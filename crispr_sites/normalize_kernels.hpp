@@ -0,0 +1,232 @@
+#ifndef CRISPR_SITES_NORMALIZE_KERNELS_HPP
+#define CRISPR_SITES_NORMALIZE_KERNELS_HPP
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRISPR_SITES_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// Normalization kernels
+// ---------------------
+//
+// A kernel normalizes a run of FASTA sequence bytes: it converts them to
+// uppercase, turns anything but ACGTN and '-' into N, drops gaps ('-') and
+// newlines, and counts both newlines and ambiguous bases.  It stops at the
+// first '>' or unprintable byte, which the caller deals with, or at the end
+// of the input.
+//
+// The AVX2 and SSE4.2 kernels classify 32 or 16 bytes at a time, and
+// compress the kept bytes 8 at a time with a shuffle table.  Their results
+// are the same as the scalar kernel's; normalize_run picks the best kernel
+// the CPU supports, once.
+
+struct normalized_run {
+    size_t consumed;     // bytes of input used up
+    size_t written;      // bytes written to out
+    size_t newlines;
+    size_t ambiguous;    // bytes turned into N
+};
+
+
+// Continue run over src[run.consumed ... n) one byte at a time.  out must
+// have room for n bytes, in all kernels.
+inline normalized_run normalize_run_scalar(const char* src, size_t n, char* out,
+                                           normalized_run run = normalized_run()) {
+    for (;  run.consumed < n;  ++run.consumed) {
+        char c = toupper(src[run.consumed]);
+        if (c == '\n') {
+            ++run.newlines;
+            continue;
+        }
+        if (c == '>' || !isprint(c)) {
+            break;
+        }
+        if (c != 'A' && c != 'T' && c != 'G' && c != 'C' && c != 'N' && c != '-') {
+            c = 'N';
+            ++run.ambiguous;
+        }
+        if (c != '-') {
+            out[run.written++] = c;
+        }
+    }
+    return run;
+}
+
+
+#ifdef CRISPR_SITES_X86_KERNELS
+
+// compaction_table()[m] shuffles the bytes selected by the 8-bit mask m to
+// the front of 8 bytes.
+inline const uint64_t* compaction_table() {
+    struct table {
+        uint64_t shuffles[256];
+        table() {
+            for (int m = 0;  m < 256;  ++m) {
+                uint64_t s = 0x8080808080808080ull;
+                int out = 0;
+                for (int j = 0;  j < 8;  ++j) {
+                    if (m & (1 << j)) {
+                        s &= ~(0xffull << (8 * out));
+                        s |= (uint64_t) j << (8 * out);
+                        ++out;
+                    }
+                }
+                shuffles[m] = s;
+            }
+        }
+    };
+    static const table t;
+    return t.shuffles;
+}
+
+
+// Write the bytes of the 8-byte groups of block selected by keep to out,
+// and return how many were written.  Each group is stored as 8 bytes, so
+// out must have 8 bytes of room past what is kept of a group.
+__attribute__((target("sse4.2")))
+inline size_t compact_groups(const char* block, uint32_t keep, int num_groups, char* out) {
+    const uint64_t* table = compaction_table();
+    size_t written = 0;
+    for (int g = 0;  g < num_groups;  ++g) {
+        const uint32_t m = (keep >> (8 * g)) & 0xff;
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block + 8 * g));
+        const __m128i shuffle = _mm_cvtsi64_si128((long long) table[m]);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + written), _mm_shuffle_epi8(bytes, shuffle));
+        written += __builtin_popcount(m);
+    }
+    return written;
+}
+
+
+__attribute__((target("avx2")))
+inline normalized_run normalize_run_avx2(const char* src, size_t n, char* out) {
+    normalized_run run = normalized_run();
+    alignas(32) char block[32];
+    while (run.consumed + 32 <= n) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + run.consumed));
+
+        const __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)),
+                                               _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+        c = _mm256_sub_epi8(c, _mm256_and_si256(lower, _mm256_set1_epi8(0x20)));
+
+        // bytes >= 0x80 are negative, so they are not printable either
+        const __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(0x1f)),
+                                                   _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), c));
+        const uint32_t newline = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')));
+        const uint32_t header = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('>')));
+        const uint32_t stops = header | ~(_mm256_movemask_epi8(printable) | newline);
+        const int len = stops ? __builtin_ctz(stops) : 32;
+        const uint32_t valid = len == 32 ? 0xffffffffu : (1u << len) - 1;
+
+        const __m256i base = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('C'))),
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('T'))),
+                            _mm256_cmpeq_epi8(c, _mm256_set1_epi8('N'))));
+        const __m256i gap = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'));
+        const __m256i ambiguous = _mm256_andnot_si256(_mm256_or_si256(base, gap), printable);
+        c = _mm256_blendv_epi8(c, _mm256_set1_epi8('N'), ambiguous);
+
+        const uint32_t keep = valid & ~(newline | (uint32_t) _mm256_movemask_epi8(gap));
+        run.newlines += __builtin_popcount(newline & valid);
+        run.ambiguous += __builtin_popcount((uint32_t) _mm256_movemask_epi8(ambiguous) & valid);
+
+        if (keep == 0xffffffffu) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + run.written), c);
+            run.written += 32;
+        } else {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(block), c);
+            run.written += compact_groups(block, keep, 4, out + run.written);
+        }
+        run.consumed += len;
+        if (len < 32) {
+            return run;
+        }
+    }
+    return normalize_run_scalar(src, n, out, run);
+}
+
+
+__attribute__((target("sse4.2")))
+inline normalized_run normalize_run_sse42(const char* src, size_t n, char* out) {
+    normalized_run run = normalized_run();
+    alignas(16) char block[16];
+    while (run.consumed + 16 <= n) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + run.consumed));
+
+        const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+                                            _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+        c = _mm_sub_epi8(c, _mm_and_si128(lower, _mm_set1_epi8(0x20)));
+
+        // bytes >= 0x80 are negative, so they are not printable either
+        const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(0x1f)),
+                                                _mm_cmplt_epi8(c, _mm_set1_epi8(0x7f)));
+        const uint32_t newline = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+        const uint32_t header = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('>')));
+        const uint32_t stops = (header | ~(_mm_movemask_epi8(printable) | newline)) & 0xffff;
+        const int len = stops ? __builtin_ctz(stops) : 16;
+        const uint32_t valid = (1u << len) - 1;
+
+        const __m128i base = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('A')), _mm_cmpeq_epi8(c, _mm_set1_epi8('C'))),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('G')), _mm_cmpeq_epi8(c, _mm_set1_epi8('T'))),
+                         _mm_cmpeq_epi8(c, _mm_set1_epi8('N'))));
+        const __m128i gap = _mm_cmpeq_epi8(c, _mm_set1_epi8('-'));
+        const __m128i ambiguous = _mm_andnot_si128(_mm_or_si128(base, gap), printable);
+        c = _mm_blendv_epi8(c, _mm_set1_epi8('N'), ambiguous);
+
+        const uint32_t keep = valid & ~(newline | (uint32_t) _mm_movemask_epi8(gap));
+        run.newlines += __builtin_popcount(newline & valid);
+        run.ambiguous += __builtin_popcount((uint32_t) _mm_movemask_epi8(ambiguous) & valid);
+
+        if (keep == 0xffff) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + run.written), c);
+            run.written += 16;
+        } else {
+            _mm_store_si128(reinterpret_cast<__m128i*>(block), c);
+            run.written += compact_groups(block, keep, 2, out + run.written);
+        }
+        run.consumed += len;
+        if (len < 16) {
+            return run;
+        }
+    }
+    return normalize_run_scalar(src, n, out, run);
+}
+
+#endif
+
+
+typedef normalized_run (*normalize_run_kernel)(const char* src, size_t n, char* out);
+
+inline normalized_run normalize_run_scalar_kernel(const char* src, size_t n, char* out) {
+    return normalize_run_scalar(src, n, out);
+}
+
+
+// The fastest kernel this CPU supports.
+inline normalize_run_kernel best_normalize_run_kernel() {
+#ifdef CRISPR_SITES_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return normalize_run_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return normalize_run_sse42;
+    }
+#endif
+    return normalize_run_scalar_kernel;
+}
+
+
+// Normalize the run at the start of src[0 ... n) into out, which must have
+// room for n bytes.
+inline normalized_run normalize_run(const char* src, size_t n, char* out) {
+    static const normalize_run_kernel kernel = best_normalize_run_kernel();
+    return kernel(src, n, out);
+}
+
+#endif
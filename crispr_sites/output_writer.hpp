@@ -0,0 +1,120 @@
+#ifndef CRISPR_SITES_OUTPUT_WRITER_HPP
+#define CRISPR_SITES_OUTPUT_WRITER_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Output is collected in a buffer of this size and written with one
+// write() call per buffer-full.
+constexpr size_t OUTPUT_BUFFER_SIZE = 8 * 1024 * 1024;
+
+
+// Write all of buf to fd, or throw.
+inline void write_fully(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        const ssize_t written = ::write(fd, buf, len);
+        if (written == (ssize_t) -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("error writing output: ") + strerror(errno));
+        }
+        buf += written;
+        len -= written;
+    }
+}
+
+
+// Number of decimal digits of x.
+inline int decimal_digits(uint64_t x) {
+    int n = 1;
+    for (;  x >= 10;  x /= 10) {
+        ++n;
+    }
+    return n;
+}
+
+
+// Format x in decimal at out, which has room for it, and return the end.
+inline char* format_uint(char* out, uint64_t x) {
+    const int n = decimal_digits(x);
+    for (int i = n - 1;  i >= 0;  --i) {
+        out[i] = '0' + x % 10;
+        x /= 10;
+    }
+    return out + n;
+}
+
+
+// A buffered writer to a file descriptor.  Callers format straight into
+// the buffer: reserve() returns room for up to n bytes, and commit() marks
+// how many of them were used.  Nothing is written until the buffer fills
+// up or flush() is called, so flush() must be called when done.
+//
+// Instead of a file descriptor, the writer can also hand each buffer-full
+// to a sink, such as a block_compressor (see compressed_output.hpp).
+class output_writer {
+public:
+    typedef std::function<void(const char*, size_t)> sink_type;
+
+    explicit output_writer(int fd, size_t capacity = OUTPUT_BUFFER_SIZE)
+        : sink([fd](const char* data, size_t len) { write_fully(fd, data, len); }),
+          buffer(capacity), used(0) {}
+
+    explicit output_writer(sink_type sink, size_t capacity = OUTPUT_BUFFER_SIZE)
+        : sink(sink), buffer(capacity), used(0) {}
+
+    char* reserve(size_t n) {
+        if (buffer.size() - used < n) {
+            flush();
+            if (buffer.size() < n) {
+                buffer.resize(n);
+            }
+        }
+        return buffer.data() + used;
+    }
+
+    void commit(size_t n) {
+        used += n;
+    }
+
+    void write(const char* data, size_t n) {
+        memcpy(reserve(n), data, n);
+        commit(n);
+    }
+
+    void write(const std::string& s) {
+        write(s.data(), s.size());
+    }
+
+    void put(char c) {
+        *reserve(1) = c;
+        commit(1);
+    }
+
+    // Write x in decimal.
+    void write_uint(uint64_t x) {
+        char* out = reserve(20);
+        commit(format_uint(out, x) - out);
+    }
+
+    void flush() {
+        if (used > 0) {
+            sink(buffer.data(), used);
+        }
+        used = 0;
+    }
+
+private:
+    const sink_type sink;
+    std::vector<char> buffer;
+    size_t used;
+};
+
+#endif
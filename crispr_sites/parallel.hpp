@@ -0,0 +1,28 @@
+#ifndef CRISPR_SITES_PARALLEL_HPP
+#define CRISPR_SITES_PARALLEL_HPP
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Run fn(t) for t = 0 ... num_threads - 1, each on its own thread, and wait
+// for all of them.  The calling thread runs the last one itself.
+template <typename F>
+void run_in_parallel(int num_threads, F fn) {
+    std::vector<std::thread> workers;
+    for (int t = 0;  t + 1 < num_threads;  ++t) {
+        workers.push_back(std::thread(fn, t));
+    }
+    fn(num_threads - 1);
+    for (auto it = workers.begin();  it != workers.end();  ++it) {
+        it->join();
+    }
+}
+
+
+// Start of the t-th of num_threads nearly equal blocks of [0, n).
+inline size_t block_start(size_t n, int t, int num_threads) {
+    return (size_t) ((unsigned __int128) n * t / num_threads);
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CRISPR_SITES_PIPELINE_HPP
+#define CRISPR_SITES_PIPELINE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// A blocking FIFO queue holding at most capacity items, to hand work from
+// one pipeline stage to the next.  A pair of these, one carrying full
+// buffers forward and one carrying free buffers back, makes a bounded ring
+// of buffers between two stages.
+template <typename T>
+class bounded_queue {
+public:
+    explicit bounded_queue(size_t capacity) : capacity(capacity) {}
+
+    // Wait until there is room, then append item.
+    void push(const T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this]() { return items.size() < capacity; });
+        items.push_back(item);
+        not_empty.notify_one();
+    }
+
+    // Wait until there is an item, then remove and return the oldest.
+    T pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]() { return !items.empty(); });
+        T item = items.front();
+        items.pop_front();
+        not_full.notify_one();
+        return item;
+    }
+
+private:
+    const size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
+
+#endif
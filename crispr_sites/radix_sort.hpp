@@ -0,0 +1,255 @@
+#ifndef CRISPR_SITES_RADIX_SORT_HPP
+#define CRISPR_SITES_RADIX_SORT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chunked_buffer.hpp"
+#include "parallel.hpp"
+
+// Parallel LSD radix sort.
+//
+// Records are sorted by an unsigned key of at most key_bits bits, RADIX_BITS
+// bits at a time starting with the least significant digit.  Every pass is
+// stable, so records with equal keys keep their input order.
+//
+// Each thread owns a contiguous block of the input.  A pass first counts the
+// digits in every block, which gives each (thread, digit) pair its own range
+// of the output, and then all threads scatter their blocks at once without
+// any synchronization.
+//
+// Digits on which all keys agree are skipped, which in particular skips the
+// unused high digits of keys shorter than key_bits.
+//
+// The passes run over plain arrays or over chunked_buffers, whose chunks
+// are released as soon as a pass has read them.
+
+constexpr int RADIX_BITS = 8;
+constexpr int RADIX_BUCKETS = 1 << RADIX_BITS;
+
+// Inputs smaller than this are sorted by one thread.
+constexpr size_t RADIX_MIN_PER_THREAD = 64 * 1024;
+
+
+typedef std::vector<size_t> radix_histogram;
+
+
+// How the sort reaches its two buffers.  radix_sort_passes only asks
+// Access for
+//
+//   at(buf, i)                         the record at index i,
+//   for_each_span(buf, begin, end, release, f)
+//                                      f(p, m) on consecutive pieces of
+//                                      records [begin, end); with release,
+//                                      each piece may be freed after f,
+//   prepare(buf, n)                    room for n records before a pass
+//                                      writes buf, and
+//   done(buf)                          after a pass has read all of buf.
+
+// Two arrays that the passes write back and forth.
+template <typename T>
+struct radix_arrays {
+    typedef T record;
+    typedef T* buffer;
+
+    static T& at(T* buf, size_t i) { return buf[i]; }
+
+    template <typename F>
+    static void for_each_span(T* buf, size_t begin, size_t end, bool, F f) {
+        f(buf + begin, end - begin);
+    }
+
+    static void prepare(T*, size_t) {}
+    static void done(T*) {}
+};
+
+// Two chunked_buffers.  Each pass writes a fresh buffer and releases the
+// chunks it reads as it goes, so the two together hold little more than
+// one copy of the records: the output's pages take up memory only once
+// written, and each bucket of the output is written from its start.
+template <typename T>
+struct radix_chunks {
+    typedef T record;
+    typedef chunked_buffer<T>* buffer;
+
+    static T& at(chunked_buffer<T>* buf, size_t i) { return (*buf)[i]; }
+
+    template <typename F>
+    static void for_each_span(chunked_buffer<T>* buf, size_t begin, size_t end, bool release, F f) {
+        const size_t chunk_size = chunked_buffer<T>::chunk_size;
+        while (begin < end) {
+            const size_t c = begin / chunk_size;
+            const size_t m = std::min(end, (c + 1) * chunk_size) - begin;
+            f(buf->chunk(c) + begin % chunk_size, m);
+            // a chunk shared with another thread's block waits for done()
+            if (release && m == buf->chunk_length(c)) {
+                buf->release_chunk(c);
+            }
+            begin += m;
+        }
+    }
+
+    static void prepare(chunked_buffer<T>* buf, size_t n) {
+        buf->clear();
+        buf->append_zeros(n);
+    }
+
+    static void done(chunked_buffer<T>* buf) {
+        buf->clear();
+    }
+};
+
+
+// Sort the n records in data, using scratch as the second buffer.
+// Returns whichever of data or scratch holds the sorted records.
+template <typename Access, typename KeyFn>
+typename Access::buffer radix_sort_passes(typename Access::buffer data, typename Access::buffer scratch,
+                                          const size_t n, KeyFn key, const int key_bits, int num_threads) {
+    typedef typename Access::record T;
+    typedef typename Access::buffer buffer;
+
+    const int num_digits = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+    if (n / RADIX_MIN_PER_THREAD < (size_t) num_threads) {
+        num_threads = (int) (n / RADIX_MIN_PER_THREAD);
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    // counts[t][d * RADIX_BUCKETS + b] is how often digit d of the keys
+    // in block t of the current input equals b
+    std::vector<radix_histogram> counts(num_threads, radix_histogram(num_digits * RADIX_BUCKETS));
+
+    // One read over the input counts all digits at once.
+    run_in_parallel(num_threads, [&](int t) {
+        size_t* c = counts[t].data();
+        Access::for_each_span(data, block_start(n, t, num_threads), block_start(n, t + 1, num_threads), false,
+                              [&](const T* p, size_t m) {
+            for (size_t i = 0;  i < m;  ++i) {
+                const uint64_t x = key(p[i]);
+                for (int d = 0;  d < num_digits;  ++d) {
+                    ++c[d * RADIX_BUCKETS + ((x >> (d * RADIX_BITS)) & (RADIX_BUCKETS - 1))];
+                }
+            }
+        });
+    });
+
+    buffer src = data;
+    buffer dst = scratch;
+    bool first_pass = true;
+    std::vector<radix_histogram> offsets(num_threads, radix_histogram(RADIX_BUCKETS));
+
+    for (int d = 0;  d < num_digits;  ++d) {
+        // Skip the digit if every key has the same value there.  The totals
+        // per digit value do not depend on the order of the input.
+        bool trivial = false;
+        for (int b = 0;  b < RADIX_BUCKETS;  ++b) {
+            size_t total = 0;
+            for (int t = 0;  t < num_threads;  ++t) {
+                total += counts[t][d * RADIX_BUCKETS + b];
+            }
+            if (total == n) {
+                trivial = true;
+                break;
+            }
+            if (total != 0) {
+                break;
+            }
+        }
+        if (trivial) {
+            continue;
+        }
+
+        const int shift = d * RADIX_BITS;
+
+        // The counts from the first read are only valid per block for the
+        // original order; later passes recount their digit.
+        if (!first_pass) {
+            run_in_parallel(num_threads, [&](int t) {
+                size_t* c = counts[t].data() + d * RADIX_BUCKETS;
+                for (int b = 0;  b < RADIX_BUCKETS;  ++b) {
+                    c[b] = 0;
+                }
+                Access::for_each_span(src, block_start(n, t, num_threads), block_start(n, t + 1, num_threads), false,
+                                      [&](const T* p, size_t m) {
+                    for (size_t i = 0;  i < m;  ++i) {
+                        ++c[(key(p[i]) >> shift) & (RADIX_BUCKETS - 1)];
+                    }
+                });
+            });
+        }
+        first_pass = false;
+
+        size_t sum = 0;
+        for (int b = 0;  b < RADIX_BUCKETS;  ++b) {
+            for (int t = 0;  t < num_threads;  ++t) {
+                offsets[t][b] = sum;
+                sum += counts[t][d * RADIX_BUCKETS + b];
+            }
+        }
+
+        Access::prepare(dst, n);
+        run_in_parallel(num_threads, [&](int t) {
+            size_t* o = offsets[t].data();
+            Access::for_each_span(src, block_start(n, t, num_threads), block_start(n, t + 1, num_threads), true,
+                                  [&](const T* p, size_t m) {
+                for (size_t i = 0;  i < m;  ++i) {
+                    const size_t b = (key(p[i]) >> shift) & (RADIX_BUCKETS - 1);
+                    Access::at(dst, o[b]++) = p[i];
+                }
+            });
+        });
+        Access::done(src);
+
+        buffer tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    return src;
+}
+
+
+// Sort data[0 ... n), using scratch[0 ... n) as the second buffer.
+// Returns whichever of data or scratch holds the sorted records.
+template <typename T, typename KeyFn>
+T* radix_sort(T* data, T* scratch, const size_t n, KeyFn key, const int key_bits, const int num_threads) {
+    return radix_sort_passes<radix_arrays<T> >(data, scratch, n, key, key_bits, num_threads);
+}
+
+
+// Sort a vector in place, by way of a temporary buffer of the same size.
+template <typename T, typename KeyFn>
+void radix_sort(std::vector<T>& v, KeyFn key, const int key_bits, const int num_threads) {
+    std::vector<T> scratch(v.size());
+    if (radix_sort(v.data(), scratch.data(), v.size(), key, key_bits, num_threads) != v.data()) {
+        v.swap(scratch);
+    }
+}
+
+
+// Sort non-negative integers that fit in key_bits bits.
+inline void radix_sort(std::vector<int64_t>& v, const int key_bits, const int num_threads) {
+    radix_sort(v, [](const int64_t x) { return (uint64_t) x; }, key_bits, num_threads);
+}
+
+
+// Sort a chunked_buffer in place.  Instead of the vector version's second
+// copy, each pass moves the records into a fresh chunked_buffer, releasing
+// the chunks it has read, so memory stays near the size of the records.
+template <typename T, typename KeyFn>
+void radix_sort(chunked_buffer<T>& buf, KeyFn key, const int key_bits, const int num_threads) {
+    chunked_buffer<T> scratch(buf.uses_huge_pages());
+    if (radix_sort_passes<radix_chunks<T> >(&buf, &scratch, buf.size(), key, key_bits, num_threads) != &buf) {
+        buf.swap(scratch);
+    }
+}
+
+
+inline void radix_sort(chunked_buffer<int64_t>& buf, const int key_bits, const int num_threads) {
+    radix_sort(buf, [](const int64_t x) { return (uint64_t) x; }, key_bits, num_threads);
+}
+
+#endif
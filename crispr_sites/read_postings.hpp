@@ -0,0 +1,126 @@
+#ifndef CRISPR_SITES_READ_POSTINGS_HPP
+#define CRISPR_SITES_READ_POSTINGS_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Read postings
+// -------------
+//
+// For -r, each distinct guide maps to the increasing list of reads it was
+// found in.  read_postings keeps these lists in compressed sparse row form:
+// the guides' codes, the offset where each guide's list starts, and one
+// flat array holding all lists back to back.
+//
+// Plain lists are arrays of uint32_t read indexes.  Compressed lists store
+// the gaps between consecutive reads of a guide (the first read is a gap
+// from 0) as LEB128 varints, 7 bits per byte with the high bit set on all
+// but the last byte of each gap, which takes one or two bytes per read when
+// the reads of a guide are close together.  Compressed lists also hold
+// read indexes of 2^32 and more.
+
+class read_postings {
+public:
+    explicit read_postings(bool compressed = false) : compressed(compressed), last_read(0) {}
+
+    // Make room for this many guides and reads in all.
+    void reserve(size_t guides, size_t total_reads) {
+        codes.reserve(guides);
+        offsets.reserve(guides);
+        if (compressed) {
+            bytes.reserve(total_reads);
+        } else {
+            reads.reserve(total_reads);
+        }
+    }
+
+    // Add read to the list of guide code.  Codes must be added in increasing
+    // order, and the reads of each code in strictly increasing order.
+    void add(int64_t code, uint64_t read) {
+        if (codes.empty() || codes.back() != code) {
+            codes.push_back(code);
+            offsets.push_back(compressed ? bytes.size() : reads.size());
+            last_read = 0;
+        }
+        if (compressed) {
+            for (uint64_t gap = read - last_read;  ;  gap >>= 7) {
+                if (gap < 0x80) {
+                    bytes.push_back((uint8_t) gap);
+                    break;
+                }
+                bytes.push_back((uint8_t) (gap | 0x80));
+            }
+        } else {
+            if (read > UINT32_MAX) {
+                throw std::runtime_error("read index too large for uncompressed read postings");
+            }
+            reads.push_back((uint32_t) read);
+        }
+        last_read = read;
+    }
+
+    bool is_compressed() const { return compressed; }
+
+    // Number of guides.
+    size_t size() const { return codes.size(); }
+
+    int64_t code(size_t i) const { return codes[i]; }
+
+    // Number of reads of guide i.
+    size_t num_reads(size_t i) const {
+        if (!compressed) {
+            return end(i) - offsets[i];
+        }
+        size_t n = 0;
+        for (size_t b = offsets[i];  b < end(i);  ++b) {
+            n += bytes[b] < 0x80;
+        }
+        return n;
+    }
+
+    // Call f(read) for the reads of guide i, in increasing order.
+    template <typename F>
+    void for_each_read(size_t i, F f) const {
+        if (!compressed) {
+            for (size_t r = offsets[i];  r < end(i);  ++r) {
+                f((uint64_t) reads[r]);
+            }
+            return;
+        }
+        uint64_t read = 0;
+        uint64_t gap = 0;
+        int shift = 0;
+        for (size_t b = offsets[i];  b < end(i);  ++b) {
+            gap |= uint64_t(bytes[b] & 0x7f) << shift;
+            shift += 7;
+            if (bytes[b] < 0x80) {
+                read += gap;
+                f(read);
+                gap = 0;
+                shift = 0;
+            }
+        }
+    }
+
+    // Bytes taken by the postings.
+    size_t memory_bytes() const {
+        return codes.size() * sizeof(int64_t) + offsets.size() * sizeof(uint64_t)
+            + reads.size() * sizeof(uint32_t) + bytes.size();
+    }
+
+private:
+    size_t end(size_t i) const {
+        return i + 1 < offsets.size() ? offsets[i + 1] : (compressed ? bytes.size() : reads.size());
+    }
+
+    const bool compressed;
+    uint64_t last_read;
+
+    std::vector<int64_t> codes;
+    std::vector<uint64_t> offsets;    // where each guide's list starts
+    std::vector<uint32_t> reads;      // plain lists
+    std::vector<uint8_t> bytes;       // compressed lists
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef CRISPR_SITES_SORTED_RUNS_HPP
+#define CRISPR_SITES_SORTED_RUNS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "radix_sort.hpp"
+
+// Sorted runs of distinct codes
+// -----------------------------
+//
+// With -u, crispr_sites deduplicates its results batch by batch while
+// scanning instead of sorting them all at the end.  Each batch is sorted,
+// made unique and pushed as a run; whenever the newest run has grown to at
+// least half the size of the one below it, the two are merged.  Run sizes
+// therefore shrink geometrically from the bottom of the stack, so there are
+// only logarithmically many runs and every code is merged only
+// logarithmically often, like the levels of a binary counter.
+//
+// Memory tracks the number of distinct codes rather than raw hits, plus the
+// transient output of the largest merge.
+
+class sorted_runs {
+public:
+    explicit sorted_runs(int key_bits) : key_bits(key_bits) {}
+
+    // Number of codes held in all runs; codes in different runs may repeat.
+    size_t size() const {
+        size_t n = 0;
+        for (auto it = runs.begin();  it != runs.end();  ++it) {
+            n += it->size();
+        }
+        return n;
+    }
+
+    size_t num_runs() const { return runs.size(); }
+
+    // Sort and deduplicate batch, and take it over as a new run.
+    void add(std::vector<int64_t>& batch, int num_threads) {
+        if (batch.empty()) {
+            return;
+        }
+        radix_sort(batch, key_bits, num_threads);
+        batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+        batch.shrink_to_fit();
+        runs.push_back(std::vector<int64_t>());
+        runs.back().swap(batch);
+
+        while (runs.size() >= 2 && 2 * runs.back().size() >= runs[runs.size() - 2].size()) {
+            merge_top();
+        }
+    }
+
+    // Merge all runs into one sorted, distinct vector, and leave no runs.
+    std::vector<int64_t> finish() {
+        while (runs.size() >= 2) {
+            merge_top();
+        }
+        std::vector<int64_t> all;
+        if (!runs.empty()) {
+            all.swap(runs.back());
+            runs.clear();
+        }
+        return all;
+    }
+
+private:
+    // Replace the top two runs by their union.
+    void merge_top() {
+        std::vector<int64_t>& a = runs[runs.size() - 2];
+        std::vector<int64_t>& b = runs.back();
+        // count the union first, so that it is allocated only once
+        std::vector<int64_t> merged(union_size(a, b));
+        std::set_union(a.begin(), a.end(), b.begin(), b.end(), merged.begin());
+        runs.pop_back();
+        runs.back().swap(merged);
+    }
+
+    static size_t union_size(const std::vector<int64_t>& a, const std::vector<int64_t>& b) {
+        size_t common = 0;
+        for (auto i = a.begin(), j = b.begin();  i != a.end() && j != b.end(); ) {
+            if (*i < *j) {
+                ++i;
+            } else if (*j < *i) {
+                ++j;
+            } else {
+                ++common;
+                ++i;
+                ++j;
+            }
+        }
+        return a.size() + b.size() - common;
+    }
+
+    const int key_bits;
+    std::vector<std::vector<int64_t> > runs;
+};
+
+#endif
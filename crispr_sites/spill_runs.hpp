@@ -0,0 +1,183 @@
+#ifndef CRISPR_SITES_SPILL_RUNS_HPP
+#define CRISPR_SITES_SPILL_RUNS_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "crispr_sites.hpp"
+#include "guide_file.hpp"
+#include "output_writer.hpp"
+
+// Spilled runs
+// ------------
+//
+// With -m, crispr_sites keeps its results in memory only up to a budget.
+// Whenever the budget is reached, the results so far are sorted,
+// deduplicated and written to a run file, and at the end a k-way merge
+// reads all runs back in order, each through a small buffer.
+//
+// A run file is a binary guide file (see guide_file.hpp) of codes, or with
+// -r of read_site records, flagged GUIDE_FILE_READ_SITES.  Run files are
+// unlinked as soon as they are created, so they go away with the process
+// however it ends.
+
+// Each run is read back through a buffer of this many bytes.
+constexpr size_t SPILL_READ_BUFFER = 1024 * 1024;
+
+
+// A guide code and a read it was found in, for -r.
+struct read_site {
+    int64_t code;
+    int64_t read;
+};
+
+inline bool operator<(const read_site& a, const read_site& b) {
+    return a.code < b.code || (a.code == b.code && a.read < b.read);
+}
+
+inline bool operator==(const read_site& a, const read_site& b) {
+    return a.code == b.code && a.read == b.read;
+}
+
+
+// An unlinked temporary file holding one run.
+class spill_run {
+public:
+    explicit spill_run(const std::string& dir) : count(0) {
+        std::string path = dir + "/crispr_sites_run.XXXXXX";
+        fd = mkstemp(&path[0]);
+        if (fd == -1) {
+            throw std::runtime_error("cannot create a run file in " + dir + ": " + strerror(errno));
+        }
+        unlink(path.c_str());
+    }
+
+    ~spill_run() {
+        close(fd);
+    }
+
+    spill_run(const spill_run&) = delete;
+    spill_run& operator=(const spill_run&) = delete;
+
+    int fd;
+    uint64_t count;     // records in the run
+};
+
+
+// Write sorted, distinct records to a new run file in dir.
+template <typename Record>
+std::unique_ptr<spill_run> write_run(const std::string& dir, const std::vector<Record>& records, uint32_t flags) {
+    std::unique_ptr<spill_run> run(new spill_run(dir));
+    guide_file_header header = make_guide_file_header(k, bits_per_base, flags, records.size());
+    header.record_size = sizeof(Record);
+    write_fully(run->fd, reinterpret_cast<const char*>(&header), sizeof(header));
+    write_fully(run->fd, reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+    run->count = records.size();
+    return run;
+}
+
+
+// Read all of buf from fd at offset, or throw.
+inline void pread_fully(int fd, char* buf, size_t len, off_t offset) {
+    while (len > 0) {
+        const ssize_t n = pread(fd, buf, len, offset);
+        if (n == (ssize_t) -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == (ssize_t) -1) {
+            throw std::runtime_error(std::string("error reading run file: ") + strerror(errno));
+        }
+        if (n == 0) {
+            throw std::runtime_error("run file is truncated");
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+}
+
+
+// Reads the records of a run in order, a buffer-full at a time.
+template <typename Record>
+class run_reader {
+public:
+    run_reader(const spill_run& run, size_t buffer_records)
+        : fd(run.fd), offset(sizeof(guide_file_header)), remaining(run.count),
+          buffer(std::max((size_t) 1, buffer_records)), pos(0), len(0) {
+        guide_file_header header;
+        pread_fully(fd, reinterpret_cast<char*>(&header), sizeof(header), 0);
+        if (header.record_size != sizeof(Record) || header.count != run.count) {
+            throw std::runtime_error("run file does not match its run");
+        }
+        refill();
+    }
+
+    bool empty() const { return pos == len; }
+    const Record& front() const { return buffer[pos]; }
+
+    void pop() {
+        if (++pos == len) {
+            refill();
+        }
+    }
+
+private:
+    void refill() {
+        len = (size_t) std::min(remaining, (uint64_t) buffer.size());
+        pread_fully(fd, reinterpret_cast<char*>(buffer.data()), len * sizeof(Record), offset);
+        offset += len * sizeof(Record);
+        remaining -= len;
+        pos = 0;
+    }
+
+    int fd;
+    off_t offset;
+    uint64_t remaining;
+    std::vector<Record> buffer;
+    size_t pos;
+    size_t len;
+};
+
+
+// Call f(record) for the records of all runs, in sorted order.  Records
+// that occur in several runs are passed to f once for each.
+template <typename Record, typename F>
+void merge_runs(const std::vector<std::unique_ptr<spill_run> >& runs, F f) {
+    std::vector<run_reader<Record> > readers;
+    readers.reserve(runs.size());
+    for (auto it = runs.begin();  it != runs.end();  ++it) {
+        readers.emplace_back(**it, SPILL_READ_BUFFER / sizeof(Record));
+    }
+
+    // a heap of the readers with records left, smallest front on top
+    auto later = [&](size_t a, size_t b) { return readers[b].front() < readers[a].front(); };
+    std::vector<size_t> heap;
+    for (size_t i = 0;  i < readers.size();  ++i) {
+        if (!readers[i].empty()) {
+            heap.push_back(i);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        run_reader<Record>& reader = readers[heap.back()];
+        f(reader.front());
+        reader.pop();
+        if (reader.empty()) {
+            heap.pop_back();
+        } else {
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,163 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../chunked_buffer.hpp"
+#include "../radix_sort.hpp"
+
+using namespace std;
+
+// unit tests for chunked_buffer
+
+TEST_CASE( "chunked buffers append across chunk boundaries", "[chunked_buffer]" ) {
+    const size_t chunk = chunked_buffer<int64_t>::chunk_size;
+
+    chunked_buffer<int64_t> buffer(true);
+    REQUIRE(buffer.empty());
+
+    vector<int64_t> expected;
+    for (int64_t i = 0;  i < 1000;  ++i) {
+        buffer.push_back(i);
+        expected.push_back(i);
+    }
+
+    // a block that straddles the first chunk boundary
+    vector<int64_t> block(chunk);
+    for (size_t i = 0;  i < block.size();  ++i) {
+        block[i] = -int64_t(i);
+    }
+    buffer.append(block);
+    expected.insert(expected.end(), block.begin(), block.end());
+
+    buffer.append(chunk + 3, 42);
+    expected.insert(expected.end(), chunk + 3, 42);
+
+    REQUIRE(buffer.size() == expected.size());
+    REQUIRE(buffer[999] == 999);
+    REQUIRE(buffer[chunk] == expected[chunk]);
+    REQUIRE(buffer[expected.size() - 1] == 42);
+
+    vector<int64_t> out = {7, 8, 9};
+    buffer.move_to(out);
+    REQUIRE(buffer.empty());
+    REQUIRE(out == expected);
+
+    buffer.push_back(5);
+    buffer.move_to(out);
+    REQUIRE(out == vector<int64_t>{5});
+
+    buffer.move_to(out);
+    REQUIRE(out.empty());
+}
+
+// A size in kB from /proc/self/status, such as VmRSS, or 0 where there is none.
+static size_t status_kb(const string& field) {
+    ifstream status("/proc/self/status");
+    for (string line;  getline(status, line); ) {
+        if (line.compare(0, field.size() + 1, field + ":") == 0) {
+            return stoul(line.substr(field.size() + 1));
+        }
+    }
+    return 0;
+}
+
+TEST_CASE( "chunked buffers release each chunk as they move to a vector", "[chunked_buffer]" ) {
+    const size_t n = 4 * chunked_buffer<int64_t>::chunk_size + 5;
+    chunked_buffer<int64_t> buffer;
+    for (size_t i = 0;  i < n;  ++i) {
+        buffer.push_back(3 * i);
+    }
+
+    // reset the peak resident size to the current one, where Linux allows it
+    ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5" << flush;
+    const bool measured = clear_refs.good() && status_kb("VmHWM") > 0;
+    const size_t filled_kb = status_kb("VmRSS");
+
+    vector<int64_t> out;
+    buffer.move_to(out);
+    const size_t peak_kb = status_kb("VmHWM");
+
+    REQUIRE(buffer.empty());
+    REQUIRE(out.size() == n);
+    size_t wrong = 0;
+    for (size_t i = 0;  i < n;  ++i) {
+        wrong += out[i] != int64_t(3 * i);
+    }
+    REQUIRE(wrong == 0);
+
+    if (measured) {
+        // about one chunk more than the contents, not twice the contents
+        REQUIRE(peak_kb < filled_kb + 2 * CHUNK_BYTES / 1024);
+    }
+}
+
+TEST_CASE( "radix sort on chunked buffers sorts stably across chunks", "[chunked_buffer]" ) {
+    // records of a key and their input position, so stability shows
+    struct record {
+        uint32_t key;
+        uint32_t position;
+    };
+    const size_t n = 2 * chunked_buffer<record>::chunk_size + 12345;
+
+    for (int num_threads = 1;  num_threads <= 3;  num_threads += 2) {
+        chunked_buffer<record> buffer;
+        vector<record> expected;
+        uint64_t x = 12345;
+        for (size_t i = 0;  i < n;  ++i) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            // few distinct keys, and a high digit that never changes
+            const record r = {(uint32_t) (x >> 52) | 0x40000000, (uint32_t) i};
+            buffer.push_back(r);
+            expected.push_back(r);
+        }
+        stable_sort(expected.begin(), expected.end(),
+                    [](const record& a, const record& b) { return a.key < b.key; });
+
+        radix_sort(buffer, [](const record& r) { return (uint64_t) r.key; }, 32, num_threads);
+        REQUIRE(buffer.size() == n);
+        size_t wrong = 0;
+        for (size_t i = 0;  i < n;  ++i) {
+            wrong += buffer[i].key != expected[i].key || buffer[i].position != expected[i].position;
+        }
+        REQUIRE(wrong == 0);
+    }
+
+    chunked_buffer<int64_t> empty;
+    radix_sort(empty, 40, 2);
+    REQUIRE(empty.empty());
+}
+
+TEST_CASE( "radix sort on chunked buffers holds about one copy of the records", "[chunked_buffer]" ) {
+    const size_t n = 4 * chunked_buffer<int64_t>::chunk_size + 5;
+    chunked_buffer<int64_t> buffer;
+    uint64_t x = 1;
+    for (size_t i = 0;  i < n;  ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        buffer.push_back((int64_t) (x >> 24));
+    }
+
+    ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5" << flush;
+    const bool measured = clear_refs.good() && status_kb("VmHWM") > 0;
+    const size_t filled_kb = status_kb("VmRSS");
+
+    radix_sort(buffer, 40, 1);
+    const size_t peak_kb = status_kb("VmHWM");
+
+    REQUIRE(buffer.size() == n);
+    size_t unsorted = 0;
+    for (size_t i = 1;  i < n;  ++i) {
+        unsorted += buffer[i - 1] > buffer[i];
+    }
+    REQUIRE(unsorted == 0);
+
+    if (measured) {
+        // a vector would need a second copy, here four chunks
+        REQUIRE(peak_kb < filled_kb + 2 * CHUNK_BYTES / 1024);
+    }
+}
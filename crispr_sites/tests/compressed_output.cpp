@@ -0,0 +1,116 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+#include "../compressed_output.hpp"
+#include "../gzip_input.hpp"
+
+using namespace std;
+
+// unit tests for compressed output
+
+// Compress blocks of data, each at most block bytes, through a
+// block_compressor into a temporary file, and return the file's contents.
+static string compress_blocks(const string& data, size_t block, int num_threads,
+                              output_compression kind = output_compression::gzip) {
+    FILE* file = tmpfile();
+    REQUIRE(file != NULL);
+    {
+        block_compressor compressor(fileno(file), kind, num_threads);
+        for (size_t pos = 0;  pos < data.size();  pos += block) {
+            compressor.write(data.data() + pos, min(block, data.size() - pos));
+        }
+        compressor.finish();
+    }
+    string contents;
+    char buf[4096];
+    rewind(file);
+    for (size_t n;  (n = fread(buf, 1, sizeof(buf), file)) > 0; ) {
+        contents.append(buf, n);
+    }
+    fclose(file);
+    return contents;
+}
+
+static string gunzip(const string& compressed) {
+    gzip_inflater inflater;
+    string inflated;
+    char out[1000];
+    const char* in = compressed.data();
+    size_t in_len = compressed.size();
+    while (in_len > 0) {
+        inflated.append(out, inflater.inflate_some(in, in_len, out, sizeof(out)));
+    }
+    inflater.finish();
+    return inflated;
+}
+
+TEST_CASE( "compressed blocks concatenate to one gzip stream", "[compressed_output]" ) {
+    string data;
+    for (int i = 0;  i < 5000;  ++i) {
+        data += "ACGTTGCAAGGCTTAGGCAT" + to_string(i) + "\n";
+    }
+    // more blocks than the compressor has slots, so that it has to wait
+    const string compressed = compress_blocks(data, 1000, 3);
+    REQUIRE(is_gzip(compressed.data(), compressed.size()));
+    REQUIRE(compressed.size() < data.size());
+    REQUIRE(gunzip(compressed) == data);
+
+    REQUIRE(gunzip(compress_blocks(data, data.size(), 1)) == data);
+}
+
+TEST_CASE( "empty compressed output is valid gzip", "[compressed_output]" ) {
+    const string compressed = compress_blocks("", 1000, 2);
+    REQUIRE(is_gzip(compressed.data(), compressed.size()));
+    REQUIRE(gunzip(compressed).empty());
+}
+
+TEST_CASE( "output_writer hands buffer-fulls to a sink", "[compressed_output]" ) {
+    string blocks;
+    output_writer out([&blocks](const char* data, size_t len) { blocks += string(data, len) + "|"; }, 8);
+    out.write("ACGT", 4);
+    out.write("TTGCA", 5);
+    out.put('\n');
+    out.flush();
+    out.flush();
+    REQUIRE(blocks == "ACGT|TTGCA\n|");
+}
+
+#ifdef CRISPR_SITES_ZSTD
+
+// Decompress a stream of zstd frames, which are expected to hold
+// expected_size bytes in all.
+static string unzstd(const string& compressed, size_t expected_size) {
+    string out(expected_size + 1, '\0');
+    const size_t size = ZSTD_decompress(&out[0], out.size(), compressed.data(), compressed.size());
+    REQUIRE(!ZSTD_isError(size));
+    out.resize(size);
+    return out;
+}
+
+TEST_CASE( "compressed blocks concatenate to one zstd stream", "[compressed_output]" ) {
+    string data;
+    for (int i = 0;  i < 5000;  ++i) {
+        data += "ACGTTGCAAGGCTTAGGCAT" + to_string(i) + "\n";
+    }
+    const string compressed = compress_blocks(data, 1000, 3, output_compression::zstd);
+    REQUIRE(compressed.size() < data.size());
+    // one frame per block, each of which knows its size
+    size_t frames = 0;
+    for (size_t pos = 0;  pos < compressed.size();  ++frames) {
+        REQUIRE(ZSTD_getFrameContentSize(compressed.data() + pos, compressed.size() - pos) <= 1000);
+        const size_t frame = ZSTD_findFrameCompressedSize(compressed.data() + pos, compressed.size() - pos);
+        REQUIRE(!ZSTD_isError(frame));
+        pos += frame;
+    }
+    REQUIRE(frames == (data.size() + 999) / 1000);
+    REQUIRE(unzstd(compressed, data.size()) == data);
+
+    const string empty = compress_blocks("", 1000, 2, output_compression::zstd);
+    REQUIRE(!empty.empty());
+    REQUIRE(unzstd(empty, 0).empty());
+}
+
+#endif
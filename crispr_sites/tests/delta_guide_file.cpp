@@ -0,0 +1,114 @@
+#include "catch.hpp"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "../crispr_sites.hpp"
+#include "../delta_guide_file.hpp"
+#include "../output_writer.hpp"
+#include "temp_file.hpp"
+
+using namespace std;
+
+// unit tests for delta guide files
+
+// forward declarations we need
+template<int len> int64_t encode(const char* buf);
+void init_encoding();
+void write_delta_guide_file(output_writer& out, delta_guide_encoder& encoder);
+
+static vector<int64_t> random_codes(size_t n, const char* bases, int num_bases) {
+    srand(23);
+    vector<int64_t> codes;
+    char guide[k - 2] = {0};
+    for (size_t i = 0;  i < n;  ++i) {
+        for (int j = 0;  j < k - 3;  ++j) {
+            // mostly the same prefix, so that gaps of all sizes occur
+            guide[j] = j < 6 && rand() % 4 ? 'A' : bases[rand() % num_bases];
+        }
+        codes.push_back(encode<k - 3>(guide));
+    }
+    sort(codes.begin(), codes.end());
+    return codes;
+}
+
+TEST_CASE( "delta guide files decode to the distinct codes", "[delta_guide_file]" ) {
+    init_encoding();
+
+    for (uint32_t flags : {GUIDE_FILE_N_EXPANDED, 0u}) {
+        const vector<int64_t> codes = flags ? random_codes(3000, "ACGT", 4) : random_codes(3000, "ACGNT", 5);
+        vector<int64_t> distinct = codes;
+        distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+
+        const temp_file tmp("delta_guide_file_test",
+                            builder_file_writer(delta_guide_encoder(k, bits_per_base, flags, 7), codes,
+                                                write_delta_guide_file));
+        {
+            delta_guide_file file(tmp.path());
+            REQUIRE(file.size() == distinct.size());
+            REQUIRE(file.num_blocks() == (distinct.size() + 6) / 7);
+            REQUIRE(file.header().flags == flags);
+            REQUIRE(file.header().value_bits_per_base == (flags ? 2u : 3u));
+
+            vector<int64_t> decoded;
+            file.for_each([&decoded](int64_t code) { decoded.push_back(code); });
+            REQUIRE(decoded == distinct);
+
+            for (size_t i = 0;  i < distinct.size();  i += 13) {
+                REQUIRE(file.contains(distinct[i]));
+                // seeking to a guide ending in N finds the next code
+                const int64_t query = (distinct[i] & ~int64_t(7)) | 3;
+                const auto next = lower_bound(distinct.begin(), distinct.end(), query);
+                delta_guide_file::cursor c(file);
+                c.seek(query);
+                REQUIRE(c.valid() == (next != distinct.end()));
+                if (c.valid()) {
+                    REQUIRE(c.code() == *next);
+                }
+            }
+            REQUIRE(!file.contains(encode<k - 3>("TTTTTTTTTTTTTTTTTTTT") + 1));
+        }
+    }
+}
+
+TEST_CASE( "delta guide files seek past guides with N", "[delta_guide_file]" ) {
+    init_encoding();
+
+    const char* guides[] = {
+        "AAAAAAAAAAAAAAAAAAAA",
+        "ACGTGGTGGCAATGCACGGT",
+        "ACGTGGTGGCAATGGAAAAA",
+        "TTTTTTTTTTTTTTTTTTTT",
+    };
+    vector<int64_t> codes;
+    for (auto g : guides) {
+        codes.push_back(encode<k - 3>(g));
+    }
+    const temp_file tmp("delta_guide_file_test",
+                        builder_file_writer(delta_guide_encoder(k, bits_per_base, GUIDE_FILE_N_EXPANDED, 2), codes,
+                                            write_delta_guide_file));
+    {
+        delta_guide_file file(tmp.path());
+        delta_guide_file::cursor c(file);
+        REQUIRE(c.code() == codes[0]);
+        c.seek(encode<k - 3>("ACGTGGTGGCAATNCACGGT"));
+        REQUIRE(c.code() == codes[1]);
+        c.seek(encode<k - 3>("ACGTGGTGGCAATGCACGGN"));
+        REQUIRE(c.code() == codes[1]);
+        c.seek(encode<k - 3>("ACGTGGTGGCAATCNNNNNN"));
+        REQUIRE(c.code() == codes[1]);
+        c.seek(encode<k - 3>("AAAAAAAAAAAAAAAAAAAA"));
+        REQUIRE(c.code() == codes[0]);
+        c.seek(encode<k - 3>("TTTTTTTTTTTTTTTTTTTN"));
+        REQUIRE(c.code() == codes[3]);
+        c.next();
+        REQUIRE(!c.valid());
+        REQUIRE(!file.contains(encode<k - 3>("ACGTGGTGGCAATNCACGGT")));
+    }
+
+    truncate(tmp.path().c_str(), sizeof(delta_file_header) + 8);
+    REQUIRE_THROWS(delta_guide_file(tmp.path()));
+}
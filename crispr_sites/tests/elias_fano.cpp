@@ -0,0 +1,122 @@
+#include "catch.hpp"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "../crispr_sites.hpp"
+#include "../elias_fano.hpp"
+#include "../output_writer.hpp"
+#include "temp_file.hpp"
+
+using namespace std;
+
+// unit tests for Elias-Fano guide files
+
+// forward declarations we need
+template<int len> int64_t encode(const char* buf);
+void init_encoding();
+void write_elias_fano_file(output_writer& out, elias_fano_builder& builder);
+
+static int64_t random_code(const char* bases, int num_bases) {
+    char guide[k - 2] = {0};
+    for (int j = 0;  j < k - 3;  ++j) {
+        // mostly the same prefix, so that some high values hold many codes
+        guide[j] = j < 8 && rand() % 8 ? 'C' : bases[rand() % num_bases];
+    }
+    return encode<k - 3>(guide);
+}
+
+TEST_CASE( "Elias-Fano guide files answer rank, select and predecessor queries", "[elias_fano]" ) {
+    init_encoding();
+    srand(23);
+
+    for (uint32_t flags : {GUIDE_FILE_N_EXPANDED, 0u}) {
+        const char* bases = flags ? "ACGT" : "ACGNT";
+        const int num_bases = flags ? 4 : 5;
+        vector<int64_t> distinct;
+        for (int i = 0;  i < 5000;  ++i) {
+            distinct.push_back(random_code(bases, num_bases));
+        }
+        sort(distinct.begin(), distinct.end());
+        distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+
+        const temp_file tmp("elias_fano_test",
+                            builder_file_writer(elias_fano_builder(k, bits_per_base, flags, distinct.size()), distinct,
+                                                write_elias_fano_file));
+        {
+            elias_fano_file file(tmp.path());
+            REQUIRE(file.size() == distinct.size());
+            REQUIRE(file.header().value_bits_per_base == (flags ? 2u : 3u));
+            for (size_t i = 0;  i < distinct.size();  ++i) {
+                REQUIRE(file.select(i) == distinct[i]);
+            }
+
+            for (int q = 0;  q < 3000;  ++q) {
+                // queries may contain N even where the set does not
+                const int64_t code = q % 2 ? distinct[rand() % distinct.size()] : random_code("ACGNT", 5);
+                const auto lower = lower_bound(distinct.begin(), distinct.end(), code);
+                const auto upper = upper_bound(distinct.begin(), distinct.end(), code);
+                REQUIRE(file.rank(code) == (uint64_t) (lower - distinct.begin()));
+                REQUIRE(file.contains(code) == (lower != upper));
+
+                int64_t found = 0;
+                REQUIRE(file.predecessor(code, found) == (upper != distinct.begin()));
+                if (upper != distinct.begin()) {
+                    REQUIRE(found == *(upper - 1));
+                }
+
+                const int prefix_bases = rand() % (k - 2);
+                const int shift = bits_per_base * (k - 3 - prefix_bases);
+                const uint64_t in_prefix =
+                    lower_bound(distinct.begin(), distinct.end(), ((code >> shift) + 1) << shift)
+                    - lower_bound(distinct.begin(), distinct.end(), code >> shift << shift);
+                REQUIRE(file.count_prefix(code, prefix_bases) == in_prefix);
+            }
+        }
+    }
+}
+
+TEST_CASE( "Elias-Fano guide files hold empty and single guide sets", "[elias_fano]" ) {
+    init_encoding();
+
+    const int64_t code = encode<k - 3>("ACGTGGTGGCAATGCACGGT");
+    for (size_t n = 0;  n <= 1;  ++n) {
+        const vector<int64_t> codes(n, code);
+        const temp_file tmp("elias_fano_test",
+                            builder_file_writer(elias_fano_builder(k, bits_per_base, GUIDE_FILE_N_EXPANDED, n), codes,
+                                                write_elias_fano_file));
+        {
+            elias_fano_file file(tmp.path());
+            REQUIRE(file.size() == n);
+            REQUIRE(file.contains(code) == (n == 1));
+            REQUIRE(file.rank(encode<k - 3>("TTTTTTTTTTTTTTTTTTTT")) == n);
+            int64_t found = 0;
+            REQUIRE(!file.predecessor(encode<k - 3>("AAAAAAAAAAAAAAAAAAAA"), found));
+            REQUIRE(file.predecessor(encode<k - 3>("ACGTGGTGGCAATGCACGTN"), found) == (n == 1));
+        }
+
+        truncate(tmp.path().c_str(), sizeof(elias_fano_header) + 8);
+        REQUIRE_THROWS(elias_fano_file(tmp.path()));
+    }
+
+    const vector<int64_t> one(1, code);
+    const temp_file tmp("elias_fano_test",
+                        builder_file_writer(elias_fano_builder(k, bits_per_base, GUIDE_FILE_N_EXPANDED, 1), one,
+                                            write_elias_fano_file));
+    {
+        elias_fano_file file(tmp.path());
+        REQUIRE(file.count_prefix(code, 0) == 1);
+        REQUIRE(file.count_prefix(code, k - 3) == 1);
+        REQUIRE_THROWS_AS(file.count_prefix(code, -1), std::invalid_argument);
+        REQUIRE_THROWS_AS(file.count_prefix(code, k - 2), std::invalid_argument);
+    }
+
+    elias_fano_builder builder(k, bits_per_base, GUIDE_FILE_N_EXPANDED, 1);
+    builder.add(code);
+    builder.add(code);
+    REQUIRE_THROWS(builder.add(code + 1));
+}
@@ -0,0 +1,110 @@
+#include "catch.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "../crispr_sites.hpp"
+#include "../fuse_filter.hpp"
+#include "../output_writer.hpp"
+#include "temp_file.hpp"
+
+using namespace std;
+
+// unit tests for binary fuse filter files
+
+// forward declarations we need
+void write_fuse_filter_file(output_writer& out, fuse_filter_builder& builder);
+
+TEST_CASE( "fuse filters hold all their codes and few others", "[fuse_filter]" ) {
+    // enough codes for two shards, all even, so that odd codes are not in the set
+    vector<int64_t> codes;
+    uint64_t x = 23;
+    for (size_t i = 0;  i < FUSE_SHARD_KEYS + FUSE_SHARD_KEYS / 4;  ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        codes.push_back((int64_t) (x >> 4) & ~int64_t(1));
+    }
+    sort(codes.begin(), codes.end());
+    codes.push_back(codes.back());
+    vector<int64_t> distinct = codes;
+    distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+
+    const temp_file tmp("fuse_filter_test",
+                        builder_file_writer(fuse_filter_builder(k, bits_per_base, GUIDE_FILE_N_EXPANDED, 2), codes,
+                                            write_fuse_filter_file));
+    {
+        fuse_filter_file filter(tmp.path());
+        REQUIRE(filter.size() == distinct.size());
+        REQUIRE(filter.header().num_shards == 2);
+        // about 9 bits per code
+        REQUIRE(filter.header().fingerprints_size * 8 < filter.size() * 10);
+
+        unique_ptr<bool[]> maybe(new bool[distinct.size()]);
+        filter.maybe_contains(distinct.data(), distinct.size(), maybe.get());
+        size_t misses = 0;
+        for (size_t i = 0;  i < distinct.size();  ++i) {
+            misses += !filter.maybe_contains(distinct[i]) + !maybe[i];
+        }
+        REQUIRE(misses == 0);
+
+        vector<int64_t> others;
+        for (size_t i = 0;  i < distinct.size();  i += 4) {
+            others.push_back(distinct[i] | 1);
+        }
+        filter.maybe_contains(others.data(), others.size(), maybe.get());
+        size_t false_positives = 0;
+        size_t differences = 0;
+        for (size_t i = 0;  i < others.size();  ++i) {
+            differences += maybe[i] != filter.maybe_contains(others[i]);
+            false_positives += maybe[i];
+        }
+        REQUIRE(differences == 0);
+        // 1 in 256 expected
+        REQUIRE(false_positives < others.size() / 150);
+    }
+
+    // the filter does not depend on the number of threads
+    {
+        const temp_file tmp1("fuse_filter_test",
+                             builder_file_writer(fuse_filter_builder(k, bits_per_base, GUIDE_FILE_N_EXPANDED, 1), codes,
+                                                 write_fuse_filter_file));
+        fuse_filter_file a(tmp.path());
+        fuse_filter_file b(tmp1.path());
+        REQUIRE(a.header().fingerprints_size == b.header().fingerprints_size);
+        for (size_t i = 0;  i < distinct.size();  i += 97) {
+            REQUIRE(a.maybe_contains(distinct[i] | 1) == b.maybe_contains(distinct[i] | 1));
+        }
+    }
+
+    truncate(tmp.path().c_str(), sizeof(fuse_filter_header) + 8);
+    REQUIRE_THROWS(fuse_filter_file(tmp.path()));
+}
+
+TEST_CASE( "fuse filters hold small and empty sets", "[fuse_filter]" ) {
+    for (size_t n = 0;  n <= 3;  ++n) {
+        vector<int64_t> codes;
+        for (size_t i = 0;  i < n;  ++i) {
+            codes.push_back(1000 + 10 * i);
+        }
+        const temp_file tmp("fuse_filter_test",
+                            builder_file_writer(fuse_filter_builder(k, bits_per_base, GUIDE_FILE_N_EXPANDED, 1), codes,
+                                                write_fuse_filter_file));
+        {
+            fuse_filter_file filter(tmp.path());
+            REQUIRE(filter.size() == n);
+            for (auto it = codes.begin();  it != codes.end();  ++it) {
+                REQUIRE(filter.maybe_contains(*it));
+            }
+            if (n == 0) {
+                REQUIRE(!filter.maybe_contains(1000));
+                bool maybe = true;
+                filter.maybe_contains(codes.data(), 0, &maybe);
+                const int64_t code = 1000;
+                filter.maybe_contains(&code, 1, &maybe);
+                REQUIRE(!maybe);
+            }
+        }
+    }
+}
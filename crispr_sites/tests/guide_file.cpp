@@ -0,0 +1,62 @@
+#include "catch.hpp"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../crispr_sites.hpp"
+#include "../guide_file.hpp"
+#include "../output_writer.hpp"
+
+using namespace std;
+
+// unit tests for binary guide files
+
+// forward declarations we need
+template<int len> int64_t encode(const char* buf);
+void init_encoding();
+void write_guide_file(output_writer& out, const vector<int64_t>& codes, uint64_t count, uint32_t flags);
+
+TEST_CASE( "guide files round trip through guide_file", "[guide_file]" ) {
+    init_encoding();
+
+    const char* guides[] = {
+        "AAAAAAAAAAAAAAAAAAAA",
+        "ACGTGGTGGCAATGCACGGT",
+        "ACGTGGTGGCAATGCACGGT",
+        "GGGGGGGGGGGGGGGGGGGG",
+        "TTTTTTTTTTTTTTTTTTTT",
+    };
+    vector<int64_t> codes;
+    for (auto g : guides) {
+        codes.push_back(encode<k - 3>(g));
+    }
+
+    char path[] = "/tmp/guide_file_test_XXXXXX";
+    const int fd = mkstemp(path);
+    REQUIRE(fd != -1);
+    output_writer out(fd);
+    write_guide_file(out, codes, 4, GUIDE_FILE_N_EXPANDED);
+    out.flush();
+    close(fd);
+
+    {
+        guide_file file(path);
+        REQUIRE(file.size() == 4);
+        REQUIRE(file.header().k == k);
+        REQUIRE(file.header().bits_per_base == 3);
+        REQUIRE(file.header().flags == GUIDE_FILE_N_EXPANDED);
+        REQUIRE(file[0] == codes[0]);
+        REQUIRE(file[1] == codes[1]);
+        REQUIRE(file[3] == codes[4]);
+        REQUIRE(file.contains(encode<k - 3>("GGGGGGGGGGGGGGGGGGGG")));
+        REQUIRE(!file.contains(encode<k - 3>("CCCCCCCCCCCCCCCCCCCC")));
+    }
+
+    truncate(path, sizeof(guide_file_header) + 8);
+    REQUIRE_THROWS(guide_file(path));
+
+    unlink(path);
+}
@@ -0,0 +1,65 @@
+#ifndef CRISPR_SITES_TESTS_GZIP_DATA_HPP
+#define CRISPR_SITES_TESTS_GZIP_DATA_HPP
+
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "catch.hpp"
+#include "../gzip_input.hpp"
+
+// gzip and BGZF test data, compressed in memory.
+
+// Compress data as one gzip member, with a BGZF header if bgzf is set.
+inline std::string compress_member(const std::string& data, bool bgzf) {
+    z_stream strm = z_stream();
+    REQUIRE(deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, bgzf ? -MAX_WBITS : 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    std::vector<char> out(deflateBound(&strm, data.size()));
+    strm.next_in = (Bytef*) data.data();
+    strm.avail_in = data.size();
+    strm.next_out = (Bytef*) out.data();
+    strm.avail_out = out.size();
+    REQUIRE(deflate(&strm, Z_FINISH) == Z_STREAM_END);
+    const std::string deflated(out.data(), out.size() - strm.avail_out);
+    deflateEnd(&strm);
+    if (!bgzf) {
+        return deflated;
+    }
+
+    const uint32_t crc = crc32(0, (const Bytef*) data.data(), data.size());
+    const size_t block_size = GZIP_HEADER_SIZE + 6 + deflated.size() + GZIP_TRAILER_SIZE;
+    const unsigned char header[] = {
+        0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+        (unsigned char) (block_size - 1), (unsigned char) ((block_size - 1) >> 8),
+    };
+    const unsigned char trailer[] = {
+        (unsigned char) crc, (unsigned char) (crc >> 8), (unsigned char) (crc >> 16), (unsigned char) (crc >> 24),
+        (unsigned char) data.size(), (unsigned char) (data.size() >> 8), 0, 0,
+    };
+    return std::string((const char*) header, sizeof(header)) + deflated + std::string((const char*) trailer, sizeof(trailer));
+}
+
+// Compress data as BGZF, in blocks of at most 60000 input bytes.
+inline std::string compress_bgzf(const std::string& data) {
+    std::string compressed;
+    for (size_t pos = 0;  pos < data.size();  pos += 60000) {
+        compressed += compress_member(data.substr(pos, 60000), true);
+    }
+    return compressed;
+}
+
+// Inflate a gzip stream of any number of members.
+inline std::string inflate_all(const std::string& compressed) {
+    gzip_inflater inflater;
+    std::string inflated;
+    std::vector<char> out(1 << 20);
+    const char* in = compressed.data();
+    size_t in_len = compressed.size();
+    while (in_len > 0) {
+        inflated.append(out.data(), inflater.inflate_some(in, in_len, out.data(), out.size()));
+    }
+    inflater.finish();
+    return inflated;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include "catch.hpp"
+
+#include <string>
+#include <vector>
+
+#include "../gzip_input.hpp"
+#include "gzip_data.hpp"
+
+using namespace std;
+
+// unit tests for gzip and BGZF input
+
+TEST_CASE( "BGZF blocks are found and inflated", "[gzip_input]" ) {
+    const string data = ">chr1\nACGTNNACGTACGGTAGGCCTTAG\n";
+    const string block = compress_member(data, true);
+
+    REQUIRE(is_gzip(block.data(), block.size()));
+    REQUIRE(bgzf_block_size(block.data(), block.size()) == (long) block.size());
+    REQUIRE(bgzf_block_size(block.data(), 5) == 0);
+    REQUIRE(bgzf_block_isize(block.data(), block.size()) == data.size());
+
+    vector<char> out(data.size());
+    bgzf_inflater inflater;
+    inflater.inflate_block(block.data(), block.size(), out.data());
+    REQUIRE(string(out.data(), out.size()) == data);
+
+    string corrupt = block;
+    corrupt[GZIP_HEADER_SIZE + 8] ^= 0x55;
+    REQUIRE_THROWS(inflater.inflate_block(corrupt.data(), corrupt.size(), out.data()));
+
+    const string plain = compress_member(data, false);
+    REQUIRE(is_gzip(plain.data(), plain.size()));
+    REQUIRE(bgzf_block_size(plain.data(), plain.size()) == -1);
+}
+
+TEST_CASE( "multi-member gzip inflates as one stream", "[gzip_input]" ) {
+    string data;
+    for (int i = 0;  i < 2000;  ++i) {
+        data += ">read" + to_string(i) + "\nACGTTGCAAGGCTTAGGCNNAT\n";
+    }
+    const size_t half = data.size() / 2;
+    const string first = compress_member(data.substr(0, half), false);
+    const string compressed = first + compress_member(data.substr(half), false) + string(4, '\0');
+
+    // feed the input in small pieces, into a small output buffer
+    gzip_inflater inflater;
+    string inflated;
+    char out[1000];
+    for (size_t pos = 0;  pos < compressed.size();  pos += 777) {
+        const char* in = compressed.data() + pos;
+        size_t in_len = min((size_t) 777, compressed.size() - pos);
+        while (in_len > 0) {
+            inflated.append(out, inflater.inflate_some(in, in_len, out, sizeof(out)));
+        }
+    }
+    inflater.finish();
+    REQUIRE(inflated == data);
+
+    gzip_inflater truncated;
+    const char* in = compressed.data();
+    size_t in_len = first.size() / 2;
+    while (in_len > 0) {
+        truncated.inflate_some(in, in_len, out, sizeof(out));
+    }
+    REQUIRE_THROWS(truncated.finish());
+}
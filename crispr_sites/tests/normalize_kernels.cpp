@@ -0,0 +1,54 @@
+#include "catch.hpp"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../normalize_kernels.hpp"
+
+using namespace std;
+
+// differential tests for the normalization kernels
+
+static void require_same_run(normalize_run_kernel kernel, const string& input) {
+    vector<char> expected_out(input.size());
+    vector<char> actual_out(input.size());
+    const normalized_run expected = normalize_run_scalar(input.data(), input.size(), expected_out.data());
+    const normalized_run actual = kernel(input.data(), input.size(), actual_out.data());
+    REQUIRE(actual.consumed == expected.consumed);
+    REQUIRE(actual.written == expected.written);
+    REQUIRE(actual.newlines == expected.newlines);
+    REQUIRE(actual.ambiguous == expected.ambiguous);
+    REQUIRE(string(actual_out.data(), actual.written) == string(expected_out.data(), expected.written));
+}
+
+TEST_CASE( "normalization kernels agree with the scalar kernel", "[normalize_kernels]" ) {
+    vector<normalize_run_kernel> kernels;
+    kernels.push_back(best_normalize_run_kernel());
+#ifdef CRISPR_SITES_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(normalize_run_avx2);
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        kernels.push_back(normalize_run_sse42);
+    }
+#endif
+
+    // mostly bases, with some of everything the kernels treat specially
+    const string common = "ACGTACGTacgtNn";
+    const string rare = "\n\n--RYkmzZ>\t\r\x80\xff";
+    srand(4321);
+    for (auto kernel : kernels) {
+        for (int trial = 0;  trial < 2000;  ++trial) {
+            const int rare_one_in = 2 + rand() % 200;
+            string input(rand() % 300, 'A');
+            for (size_t i = 0;  i < input.size();  ++i) {
+                input[i] = (rand() % rare_one_in == 0) ? rare[rand() % rare.size()] : common[rand() % common.size()];
+            }
+            require_same_run(kernel, input);
+        }
+
+        require_same_run(kernel, string(100, 'G') + ">chr2\n" + string(100, 'C'));
+        require_same_run(kernel, string(64, 'a') + "\n" + string(63, '-') + "\n");
+    }
+}
@@ -0,0 +1,49 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../crispr_sites.hpp"
+
+using namespace std;
+
+// unit tests for 2-bit packed guides
+
+// forward declarations we need
+template<int len> int64_t encode(const char* buf);
+uint64_t pack_guide(int64_t code);
+int64_t unpack_guide(uint64_t packed);
+void init_encoding();
+
+TEST_CASE( "packed guides round trip and sort like guide codes", "[packed_guides]" ) {
+    init_encoding();
+    srand(3);
+
+    REQUIRE(pack_guide(encode<k - 3>("AAAAAAAAAAAAAAAAAAAA")) == 0);
+    REQUIRE(pack_guide(encode<k - 3>("TTTTTTTTTTTTTTTTTTTT")) == (uint64_t(1) << 2 * (k - 3)) - 1);
+    REQUIRE(pack_guide(encode<k - 3>("AAAAAAAAAAAAAAAAAAGT")) == 0xb);
+
+    vector<int64_t> codes;
+    for (int i = 0;  i < 1000;  ++i) {
+        string guide;
+        for (int j = 0;  j < k - 3;  ++j) {
+            guide += "ACGT"[rand() % 4];
+        }
+        codes.push_back(encode<k - 3>(guide.c_str()));
+    }
+    sort(codes.begin(), codes.end());
+
+    uint64_t last = 0;
+    for (size_t i = 0;  i < codes.size();  ++i) {
+        const uint64_t packed = pack_guide(codes[i]);
+        REQUIRE(unpack_guide(packed) == codes[i]);
+        REQUIRE(packed < (uint64_t(1) << 2 * (k - 3)));
+        if (i > 0) {
+            REQUIRE(last <= packed);
+        }
+        last = packed;
+    }
+}
@@ -0,0 +1,56 @@
+#include "catch.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "../read_postings.hpp"
+
+using namespace std;
+
+// unit tests for read postings
+
+TEST_CASE( "read postings return the reads of every guide", "[read_postings]" ) {
+    srand(5);
+
+    // guides with increasing codes, each with increasing reads, some far apart
+    vector<pair<int64_t, vector<uint64_t> > > lists;
+    int64_t code = 0;
+    for (int i = 0;  i < 500;  ++i) {
+        code += 1 + rand() % 1000;
+        vector<uint64_t> reads;
+        uint64_t read = rand() % 3;
+        for (int n = 1 + rand() % 20;  n > 0;  --n) {
+            reads.push_back(read);
+            read += 1 + (rand() % 4 == 0 ? rand() % 1000000 : rand() % 10);
+        }
+        lists.push_back(make_pair(code, reads));
+    }
+
+    for (bool compressed : {false, true}) {
+        read_postings postings(compressed);
+        for (auto& list : lists) {
+            for (auto read : list.second) {
+                postings.add(list.first, read);
+            }
+        }
+        REQUIRE(postings.size() == lists.size());
+        for (size_t i = 0;  i < lists.size();  ++i) {
+            REQUIRE(postings.code(i) == lists[i].first);
+            REQUIRE(postings.num_reads(i) == lists[i].second.size());
+            vector<uint64_t> reads;
+            postings.for_each_read(i, [&](uint64_t read) { reads.push_back(read); });
+            REQUIRE(reads == lists[i].second);
+        }
+    }
+
+    read_postings plain;
+    REQUIRE_THROWS(plain.add(1, uint64_t(1) << 32));
+    read_postings compressed(true);
+    compressed.add(1, uint64_t(1) << 40);
+    compressed.add(1, (uint64_t(1) << 40) + 1);
+    vector<uint64_t> reads;
+    compressed.for_each_read(0, [&](uint64_t read) { reads.push_back(read); });
+    REQUIRE(reads == (vector<uint64_t>{uint64_t(1) << 40, (uint64_t(1) << 40) + 1}));
+}
@@ -0,0 +1,85 @@
+#include "catch.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../crispr_sites.hpp"
+
+using namespace std;
+
+// differential tests for the scan_for_kmers kernel
+
+// forward declarations we need
+void init_encoding();
+int scan_for_kmers(vector<int64_t>& results, const char* buf, size_t len);
+int scan_for_kmers_by_window(vector<int64_t>& results, const char* buf, size_t len,
+                             int max_N, bool expand_N_variants);
+void set_N_policy(int max_N, bool expand_N_variants);
+
+// A random sequence over ACGTN, with N about one base in n_one_in.
+static string random_bases(size_t len, int n_one_in) {
+    const char* bases = "ACGT";
+    string s(len, 'A');
+    for (size_t i = 0;  i < len;  ++i) {
+        s[i] = (rand() % n_one_in == 0) ? 'N' : bases[rand() % 4];
+    }
+    return s;
+}
+
+TEST_CASE( "scan_for_kmers matches scan_for_kmers_by_window", "[scan_kernel]" ) {
+    init_encoding();
+    srand(12345);
+
+    const int n_rates[] = {1000000, 50, 8, 2};
+    for (int n_one_in : n_rates) {
+        for (int trial = 0;  trial < 200;  ++trial) {
+            const string s = random_bases(rand() % 400, n_one_in);
+            vector<int64_t> expected;
+            vector<int64_t> actual;
+            const int expected_count = scan_for_kmers_by_window(expected, s.data(), s.size(),
+                                                                default_max_N, default_expand_N_variants);
+            const int actual_count = scan_for_kmers(actual, s.data(), s.size());
+            REQUIRE(actual_count == expected_count);
+            REQUIRE(actual == expected);
+        }
+    }
+
+    // runs of PAM bases and wildcards
+    const char* edge_cases[] = {
+        "GGGGGGGGGGGGGGGGGGGGGGGGGGGGGGG",
+        "CCCCCCCCCCCCCCCCCCCCCCCCCCCCCCC",
+        "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN",
+        "CCNACGTACGTACGTACGTACGTNGGCCNNG",
+        "ACGTACGTACGTACGTACGTAGG",
+        "CCAACGTACGTACGTACGTACGT",
+    };
+    for (auto s : edge_cases) {
+        vector<int64_t> expected;
+        vector<int64_t> actual;
+        scan_for_kmers_by_window(expected, s, strlen(s), default_max_N, default_expand_N_variants);
+        scan_for_kmers(actual, s, strlen(s));
+        REQUIRE(actual == expected);
+    }
+}
+
+TEST_CASE( "scan_for_kmers matches scan_for_kmers_by_window for every N policy", "[scan_kernel]" ) {
+    init_encoding();
+    srand(54321);
+
+    for (int max_N = 0;  max_N <= max_max_N;  ++max_N) {
+        for (int expand = 0;  expand < 2;  ++expand) {
+            set_N_policy(max_N, expand);
+            for (int trial = 0;  trial < 100;  ++trial) {
+                const string s = random_bases(rand() % 400, 2 + trial % 10);
+                vector<int64_t> expected;
+                vector<int64_t> actual;
+                scan_for_kmers_by_window(expected, s.data(), s.size(), max_N, expand);
+                scan_for_kmers(actual, s.data(), s.size());
+                REQUIRE(actual == expected);
+            }
+        }
+    }
+    set_N_policy(default_max_N, default_expand_N_variants);
+}
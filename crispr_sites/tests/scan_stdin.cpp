@@ -2,15 +2,26 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <iostream>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <time.h>
+#ifdef CRISPR_SITES_ZSTD
+#include <zstd.h>
+#endif
 
 #include "../crispr_sites.hpp"
+#include "gzip_data.hpp"
+#include "temp_file.hpp"
 
 using namespace std;
 
@@ -18,6 +29,9 @@ using namespace std;
 
 // forward declarations we need
 void scan_stdin(bool output_counts);
+void scan_stdin(const scan_options& options);
+const char* option_conflict(const scan_options& options);
+bool parse_number(const char* arg, long long min, long long max, long long& value);
 
 void decode(char* buf, const int len, const int64_t code);
 template<int len> int64_t encode(const char* buf);
@@ -259,3 +273,379 @@ TEST_CASE( "scan_stdin correctly finds crispr sites", "[scan_stdin]" ) {
 	REQUIRE(valid_detection == true);
     }
 }
+
+
+// The contents of the file at path.
+static string read_file(const string& path) {
+    ifstream in(path, ios::binary);
+    ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// Run scan_stdin(options) on the FASTA input, with stderr discarded, and
+// return what it wrote to stdout.
+static string run_scan_stdin(const scan_options& options, const string& input) {
+    const temp_file input_file("scan_stdin_input", [&input](output_writer& out) { out.write(input.data(), input.size()); });
+    const temp_file output_file("scan_stdin_output", [](output_writer&) {});
+
+    const int saved[3] = {dup(STDIN_FILENO), dup(STDOUT_FILENO), dup(STDERR_FILENO)};
+    const int fds[3] = {open(input_file.path().c_str(), O_RDONLY), open(output_file.path().c_str(), O_WRONLY),
+                        open("/dev/null", O_WRONLY)};
+    for (int i = 0;  i < 3;  ++i) {
+        REQUIRE(saved[i] != -1);
+        REQUIRE(fds[i] != -1);
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    exception_ptr failure;
+    try {
+        scan_stdin(options);
+    } catch (...) {
+        failure = current_exception();
+    }
+
+    for (int i = 0;  i < 3;  ++i) {
+        dup2(saved[i], i);
+        close(saved[i]);
+    }
+    if (failure) {
+        rethrow_exception(failure);
+    }
+    return read_file(output_file.path());
+}
+
+// A FASTA file of num_reads reads of read_length bases, in lines of 60.
+// The bases hold no PAM by chance (see random_sequence_no_pam), but one is
+// put on either strand every 200 bases or so.  There are a few N, and one
+// read in four is lowercase.
+static string test_fasta(int num_reads, int read_length) {
+    vector<char> bases(read_length);
+    string fasta;
+    for (int r = 0;  r < num_reads;  ++r) {
+        random_sequence_no_pam(bases.data(), read_length);
+        for (int i = 2;  i < read_length;  i += 100 + rand() % 200) {
+            if (rand() % 2) {
+                bases[i - 1] = bases[i] = 'G';
+            } else {
+                bases[i - 2] = bases[i - 1] = 'C';
+            }
+        }
+        for (int i = rand() % 1000;  i < read_length;  i += 1 + rand() % 1000) {
+            bases[i] = 'N';
+        }
+        if (r % 4 == 3) {
+            transform(bases.begin(), bases.end(), bases.begin(), ::tolower);
+        }
+
+        fasta += ">read" + to_string(r) + " test\n";
+        for (int i = 0;  i < read_length;  ++i) {
+            fasta += bases[i];
+            if (i % 60 == 59) {
+                fasta += '\n';
+            }
+        }
+        fasta += '\n';
+    }
+    return fasta;
+}
+
+TEST_CASE( "scan_stdin fails cleanly when -m cannot write its run files", "[scan_stdin]" ) {
+    init_encoding();
+    srand(23);
+    const string input = test_fasta(100, 1000);
+
+    scan_options options;
+    REQUIRE(!run_scan_stdin(options, input).empty());
+
+    // spill at the end of the first window, into a directory that is not there
+    options.memory_budget = 1;
+    options.spill_dir = "/nonexistent";
+    REQUIRE_THROWS_WITH(run_scan_stdin(options, input), Catch::Contains("cannot create a run file"));
+}
+
+// A FASTA input a little over one STRIDE_SIZE, so that every way of
+// scanning crosses a window or piece boundary, in a string and in a file.
+// expected and expected_reads are its output by default and with -r: one
+// thread, through the input pipeline, to stdout.  Tests compare outputs
+// with extra parentheses, so that a failure does not print megabytes of
+// guides.
+struct window_input {
+    window_input()
+        : fasta((srand(23), test_fasta(STRIDE_SIZE / 50000 + 30, 50000))),
+          file("scan_stdin_fasta", [this](output_writer& out) { out.write(fasta.data(), fasta.size()); }),
+          expected(run_scan_stdin(scan_options(), fasta)),
+          expected_reads(run_scan_stdin(reads_options(), fasta)) {}
+
+    static scan_options reads_options() {
+        scan_options options;
+        options.output_reads = true;
+        return options;
+    }
+
+    const string fasta;
+    const temp_file file;
+    const string expected;
+    const string expected_reads;
+};
+
+// The window_input, made by the first test that needs it.  Call
+// init_encoding() first.
+static const window_input& one_window() {
+    static const window_input input;
+    return input;
+}
+
+TEST_CASE( "scan_stdin with -t finds the same guides and reads as one thread", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+    REQUIRE(count(w.expected.begin(), w.expected.end(), '\n') > 100000);
+    REQUIRE(w.expected_reads.size() > w.expected.size());
+
+    scan_options options;
+    options.num_threads = 3;
+    REQUIRE((run_scan_stdin(options, w.fasta) == w.expected));
+    options.output_reads = true;
+    REQUIRE((run_scan_stdin(options, w.fasta) == w.expected_reads));
+}
+
+TEST_CASE( "scan_stdin writes -r only as text", "[scan_stdin]" ) {
+    scan_options options;
+    options.output_reads = true;
+    REQUIRE(option_conflict(options) == nullptr);
+    options.format = output_format::binary;
+    REQUIRE(option_conflict(options) != nullptr);
+}
+
+TEST_CASE( "scan_stdin with -i finds the same guides and reads as on stdin", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+
+    scan_options options;
+    options.input_path = w.file.path();
+    for (int num_threads : {1, 3}) {
+        options.num_threads = num_threads;
+        options.output_reads = false;
+        REQUIRE((run_scan_stdin(options, "") == w.expected));
+        options.output_reads = true;
+        REQUIRE((run_scan_stdin(options, "") == w.expected_reads));
+    }
+}
+
+TEST_CASE( "scan_stdin finds the same guides in gzip and BGZF input", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+    const string gzip_input = compress_member(w.fasta, false);
+    const string bgzf_input = compress_bgzf(w.fasta);
+    const temp_file bgzf_fasta("scan_stdin_bgzf", [&bgzf_input](output_writer& out) {
+        out.write(bgzf_input.data(), bgzf_input.size());
+    });
+
+    // BGZF blocks are inflated in parallel with -t
+    scan_options options;
+    REQUIRE((run_scan_stdin(options, gzip_input) == w.expected));
+    options.num_threads = 3;
+    REQUIRE((run_scan_stdin(options, bgzf_input) == w.expected));
+    options.input_path = bgzf_fasta.path();
+    REQUIRE((run_scan_stdin(options, "") == w.expected));
+}
+
+TEST_CASE( "scan_stdin with -w finds the same guides", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+
+    // the variants of guides with N are merged in as the output is written
+    scan_options options;
+    options.lazy_wildcards = true;
+    REQUIRE(option_conflict(options) == nullptr);
+    REQUIRE((run_scan_stdin(options, w.fasta) == w.expected));
+    options.num_threads = 3;
+    options.input_path = w.file.path();
+    REQUIRE((run_scan_stdin(options, "") == w.expected));
+
+    options = scan_options();
+    options.lazy_wildcards = true;
+    options.output_reads = true;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.output_reads = false;
+    options.expand_N_variants = false;
+    REQUIRE(option_conflict(options) != nullptr);
+}
+
+TEST_CASE( "scan_stdin with -c finds the same guides", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+
+    scan_options options;
+    options.count_first = true;
+    options.input_path = w.file.path();
+    REQUIRE(option_conflict(options) == nullptr);
+    for (int num_threads : {1, 3}) {
+        options.num_threads = num_threads;
+        REQUIRE((run_scan_stdin(options, "") == w.expected));
+    }
+
+    options = scan_options();
+    options.count_first = true;
+    options.output_reads = true;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.output_reads = false;
+    options.lazy_wildcards = true;
+    REQUIRE(option_conflict(options) != nullptr);
+
+    // -c needs an uncompressed file to map
+    srand(23);
+    const string input = test_fasta(10, 1000);
+    const string gzip_input = compress_member(input, false);
+    const temp_file gzip_fasta("scan_stdin_gzip", [&gzip_input](output_writer& out) {
+        out.write(gzip_input.data(), gzip_input.size());
+    });
+    options = scan_options();
+    options.count_first = true;
+    REQUIRE_THROWS_WITH(run_scan_stdin(options, input), Catch::Contains("-c needs"));
+    options.input_path = gzip_fasta.path();
+    REQUIRE_THROWS_WITH(run_scan_stdin(options, ""), Catch::Contains("-c needs"));
+}
+
+TEST_CASE( "scan_stdin with -u finds the same guides", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+
+    scan_options options;
+    options.dedup_batches = true;
+    REQUIRE(option_conflict(options) == nullptr);
+    REQUIRE((run_scan_stdin(options, w.fasta) == w.expected));
+    options.input_path = w.file.path();
+    REQUIRE((run_scan_stdin(options, "") == w.expected));
+
+    options = scan_options();
+    options.dedup_batches = true;
+    options.output_reads = true;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.output_reads = false;
+    options.count_first = true;
+    REQUIRE(option_conflict(options) != nullptr);
+}
+
+TEST_CASE( "scan_stdin with -m finds the same guides and reads", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+
+    // a budget of one byte spills every window
+    scan_options options;
+    options.memory_budget = 1;
+    options.spill_dir = "/tmp";
+    REQUIRE(option_conflict(options) == nullptr);
+    for (const string& input_path : {string(), w.file.path()}) {
+        options.input_path = input_path;
+        options.output_reads = false;
+        REQUIRE((run_scan_stdin(options, w.fasta) == w.expected));
+        options.output_reads = true;
+        REQUIRE((run_scan_stdin(options, w.fasta) == w.expected_reads));
+    }
+
+    options = scan_options();
+    options.memory_budget = 1;
+    options.count_first = true;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.count_first = false;
+    options.dedup_batches = true;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.dedup_batches = false;
+    options.lazy_wildcards = true;
+    REQUIRE(option_conflict(options) != nullptr);
+}
+
+TEST_CASE( "scan_stdin with -o writes the same guides", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+    const temp_file output("scan_stdin_output", [](output_writer&) {});
+
+    // mapped and written in parallel
+    scan_options options;
+    options.num_threads = 3;
+    options.output_path = output.path();
+    REQUIRE(run_scan_stdin(options, w.fasta).empty());
+    REQUIRE((read_file(output.path()) == w.expected));
+}
+
+TEST_CASE( "scan_stdin with -P finds the same guides", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+
+    scan_options options;
+    options.packed_guides = true;
+    REQUIRE(option_conflict(options) == nullptr);
+    REQUIRE((run_scan_stdin(options, w.fasta) == w.expected));
+    options.num_threads = 3;
+    options.input_path = w.file.path();
+    REQUIRE((run_scan_stdin(options, "") == w.expected));
+
+    options = scan_options();
+    options.packed_guides = true;
+    options.expand_N_variants = false;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.expand_N_variants = true;
+    options.output_reads = true;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.output_reads = false;
+    options.count_first = true;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.count_first = false;
+    options.dedup_batches = true;
+    REQUIRE(option_conflict(options) != nullptr);
+    options.dedup_batches = false;
+    options.memory_budget = 1;
+    REQUIRE(option_conflict(options) != nullptr);
+}
+
+TEST_CASE( "scan_stdin with -z or -Z writes the same guides, compressed", "[scan_stdin]" ) {
+    init_encoding();
+    const window_input& w = one_window();
+    const temp_file output("scan_stdin_output", [](output_writer&) {});
+
+    // compressed on three threads, to stdout and into an -o file
+    scan_options options;
+    options.num_threads = 3;
+    options.compression = output_compression::gzip;
+    REQUIRE((inflate_all(run_scan_stdin(options, w.fasta)) == w.expected));
+    options.output_path = output.path();
+    REQUIRE(run_scan_stdin(options, w.fasta).empty());
+    REQUIRE((inflate_all(read_file(output.path())) == w.expected));
+
+#ifdef CRISPR_SITES_ZSTD
+    // -Z, whose frames decompress as one stream
+    options.output_path.clear();
+    options.compression = output_compression::zstd;
+    const string compressed = run_scan_stdin(options, w.fasta);
+    string decompressed(w.expected.size(), '\0');
+    REQUIRE(ZSTD_decompress(&decompressed[0], decompressed.size(), compressed.data(), compressed.size())
+            == w.expected.size());
+    REQUIRE((decompressed == w.expected));
+#endif
+}
+
+TEST_CASE( "numeric options take whole numbers in range only", "[scan_stdin]" ) {
+    long long value = -1;
+    REQUIRE(parse_number("2", 0, 5, value));
+    REQUIRE(value == 2);
+    REQUIRE(parse_number("0", 0, 5, value));
+    REQUIRE(value == 0);
+    for (const char* arg : {"", "abc", "2x", "4k", "1.5", "6", "-1", "99999999999999999999"}) {
+        value = -1;
+        REQUIRE(!parse_number(arg, 0, 5, value));
+        REQUIRE(value == -1);
+    }
+    // -t
+    REQUIRE(parse_number("16", 1, INT_MAX, value));
+    REQUIRE(value == 16);
+    REQUIRE(!parse_number("0", 1, INT_MAX, value));
+    REQUIRE(!parse_number("4k", 1, INT_MAX, value));
+    REQUIRE(!parse_number("4294967296", 1, INT_MAX, value));
+    // -m
+    REQUIRE(parse_number("32000", 1, LLONG_MAX >> 20, value));
+    REQUIRE(value == 32000);
+    REQUIRE(!parse_number("32G", 1, LLONG_MAX >> 20, value));
+    REQUIRE(!parse_number("9223372036854775807", 1, LLONG_MAX >> 20, value));
+}
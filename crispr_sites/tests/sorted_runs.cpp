@@ -0,0 +1,37 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "../sorted_runs.hpp"
+
+using namespace std;
+
+// unit tests for sorted_runs
+
+TEST_CASE( "sorted runs merge batches into their distinct codes", "[sorted_runs]" ) {
+    srand(7);
+
+    sorted_runs runs(20);
+    vector<int64_t> all;
+    for (int b = 0;  b < 100;  ++b) {
+        // batches of varying size, with plenty of repeats within and across them
+        vector<int64_t> batch(rand() % 5000);
+        for (auto& code : batch) {
+            code = rand() % 100000;
+        }
+        all.insert(all.end(), batch.begin(), batch.end());
+        runs.add(batch, 1 + b % 3);
+        REQUIRE(batch.empty());
+        REQUIRE(runs.num_runs() <= 20);
+    }
+
+    sort(all.begin(), all.end());
+    all.erase(unique(all.begin(), all.end()), all.end());
+
+    REQUIRE(runs.finish() == all);
+    REQUIRE(runs.num_runs() == 0);
+    REQUIRE(runs.finish().empty());
+}
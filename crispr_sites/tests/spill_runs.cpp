@@ -0,0 +1,56 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "../spill_runs.hpp"
+
+using namespace std;
+
+// unit tests for spilled runs
+
+TEST_CASE( "spilled runs merge back in order", "[spill_runs]" ) {
+    srand(11);
+
+    vector<unique_ptr<spill_run> > code_runs;
+    vector<unique_ptr<spill_run> > site_runs;
+    vector<int64_t> all_codes;
+    vector<read_site> all_sites;
+    for (int r = 0;  r < 7;  ++r) {
+        // one run spans several read buffers, the others fit in one
+        vector<read_site> sites(r == 3 ? 3 * SPILL_READ_BUFFER / sizeof(read_site) : rand() % 1000);
+        for (auto& site : sites) {
+            site.code = 1 + rand() % 5000;
+            site.read = rand() % 10;
+        }
+        sort(sites.begin(), sites.end());
+        sites.erase(unique(sites.begin(), sites.end()), sites.end());
+        vector<int64_t> codes;
+        for (auto& site : sites) {
+            codes.push_back(site.code);
+        }
+        codes.erase(unique(codes.begin(), codes.end()), codes.end());
+
+        code_runs.push_back(write_run("/tmp", codes, 0));
+        site_runs.push_back(write_run("/tmp", sites, GUIDE_FILE_READ_SITES));
+        all_codes.insert(all_codes.end(), codes.begin(), codes.end());
+        all_sites.insert(all_sites.end(), sites.begin(), sites.end());
+    }
+    sort(all_codes.begin(), all_codes.end());
+    sort(all_sites.begin(), all_sites.end());
+
+    vector<int64_t> merged_codes;
+    merge_runs<int64_t>(code_runs, [&](int64_t code) { merged_codes.push_back(code); });
+    REQUIRE(merged_codes == all_codes);
+
+    vector<read_site> merged_sites;
+    merge_runs<read_site>(site_runs, [&](const read_site& site) { merged_sites.push_back(site); });
+    REQUIRE(merged_sites.size() == all_sites.size());
+    REQUIRE(equal(merged_sites.begin(), merged_sites.end(), all_sites.begin()));
+
+    // runs of the wrong record type are refused
+    REQUIRE_THROWS(merge_runs<read_site>(code_runs, [](const read_site&) {}));
+}
@@ -0,0 +1,69 @@
+#ifndef CRISPR_SITES_TESTS_TEMP_FILE_HPP
+#define CRISPR_SITES_TESTS_TEMP_FILE_HPP
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../output_writer.hpp"
+
+// A file in /tmp that a test writes and then reads back.  It is removed
+// when the temp_file goes out of scope, also when a REQUIRE fails.
+class temp_file {
+public:
+    // Create the file as /tmp/<name>_XXXXXX, and fill it by calling
+    // write(out), e.g. one made by builder_file_writer below.
+    temp_file(const std::string& name, const std::function<void(output_writer&)>& write) {
+        std::string path_template = "/tmp/" + name + "_XXXXXX";
+        const int fd = mkstemp(&path_template[0]);
+        if (fd == -1) {
+            throw std::runtime_error("cannot create a temporary file for " + name);
+        }
+        file_path = path_template;
+        try {
+            output_writer out(fd);
+            write(out);
+            out.flush();
+        } catch (...) {
+            close(fd);
+            unlink(file_path.c_str());
+            throw;
+        }
+        close(fd);
+    }
+
+    ~temp_file() {
+        unlink(file_path.c_str());
+    }
+
+    temp_file(const temp_file&) = delete;
+    temp_file& operator=(const temp_file&) = delete;
+
+    const std::string& path() const { return file_path; }
+
+private:
+    std::string file_path;
+};
+
+
+// A writer for temp_file that adds the sorted codes to builder and then
+// writes the file with write_file, e.g. write_delta_guide_file.
+template <typename Builder>
+std::function<void(output_writer&)> builder_file_writer(Builder builder, const std::vector<int64_t>& codes,
+                                                        void (*write_file)(output_writer&, Builder&)) {
+    std::shared_ptr<Builder> b = std::make_shared<Builder>(std::move(builder));
+    return [b, &codes, write_file](output_writer& out) {
+        for (auto it = codes.begin();  it != codes.end();  ++it) {
+            b->add(*it);
+        }
+        write_file(out, *b);
+    };
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../crispr_sites.hpp"
+#include "../wildcard_guides.hpp"
+
+using namespace std;
+
+// unit tests for wildcard guides
+
+// forward declarations we need
+template<int len> int64_t encode(const char* buf);
+void init_encoding();
+
+TEST_CASE( "wildcard tables cover exactly the variants of their guides", "[wildcard_guides]" ) {
+    init_encoding();
+
+    const char* wildcards[] = {
+        "ACGTGGTGGCAATGCACGNT",
+        "NCGTGGTGGCAATGCACGGT",
+        "ACGTGGTGGCAATGCACGNT",   // a duplicate
+        "TTTTTNTTTTTTTTTTNTTT",
+    };
+    vector<wildcard_guide> guides;
+    for (auto g : wildcards) {
+        guides.push_back(make_wildcard_guide(encode<k - 3>(g)));
+    }
+    REQUIRE(guides[0].N_mask == 2);
+    REQUIRE(guides[1].N_mask == (uint32_t(1) << 19));
+
+    const wildcard_table table(guides);
+    REQUIRE(table.size() == 3);
+
+    vector<int64_t> variants;
+    table.for_each_variant([&](int64_t code) { variants.push_back(code); });
+    REQUIRE(variants.size() == 4 + 4 + 16);
+    // in order, with the variant the first two guides share twice
+    REQUIRE(is_sorted(variants.begin(), variants.end()));
+    REQUIRE(count(variants.begin(), variants.end(), encode<k - 3>("ACGTGGTGGCAATGCACGGT")) == 2);
+
+    for (auto code : variants) {
+        REQUIRE(table.covers(code));
+    }
+    REQUIRE(table.covers(encode<k - 3>("ACGTGGTGGCAATGCACGGT")));
+    REQUIRE(table.covers(encode<k - 3>("TTTTTCTTTTTTTTTTGTTT")));
+    REQUIRE(!table.covers(encode<k - 3>("ACGTGGTGGCAATGCACCCT")));
+    REQUIRE(!table.covers(encode<k - 3>("TTTTTCTTTTTTTTTTGTTA")));
+    REQUIRE(!wildcard_table().covers(encode<k - 3>("ACGTGGTGGCAATGCACGGT")));
+}
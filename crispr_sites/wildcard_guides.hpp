@@ -0,0 +1,192 @@
+#ifndef CRISPR_SITES_WILDCARD_GUIDES_HPP
+#define CRISPR_SITES_WILDCARD_GUIDES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "crispr_sites.hpp"
+#include "radix_sort.hpp"
+
+// Wildcard guides
+// ---------------
+//
+// A guide with N bases stands for all of its 4^N variants with A, C, G or T
+// in place of each N.  With -w, crispr_sites keeps such a guide as a single
+// wildcard_guide instead of expanding it while scanning: the guide's code
+// with its N digits cleared, and a mask of where the N digits were.
+//
+// A wildcard_table holds the distinct wildcard guides, sorted by N_mask and
+// then code.  Guides with the same N_mask form one sorted run, so a
+// concrete guide is covered by the table if, for any of the (few) distinct
+// masks, the guide's code with the mask's digits cleared is in that run.
+
+struct wildcard_guide {
+    int64_t code;       // guide code, with the N digits set to 0
+    uint32_t N_mask;    // bit i set if digit i (from the lowest) was N
+};
+
+// A guide's code has at most this many digits.
+constexpr int WILDCARD_DIGITS = k - 3;
+
+constexpr int64_t WILDCARD_DIGIT_MASK = (int64_t(1) << bits_per_base) - 1;
+constexpr int64_t WILDCARD_N_DIGIT = 3;
+
+
+// The low bit of each digit of a guide code.
+constexpr int64_t wildcard_digit_lsbs(int digits = WILDCARD_DIGITS) {
+    return digits == 0 ? 0 : (wildcard_digit_lsbs(digits - 1) << bits_per_base) | 1;
+}
+
+
+// The wildcard guide for a guide code with N digits.
+inline wildcard_guide make_wildcard_guide(int64_t code) {
+    static_assert(WILDCARD_N_DIGIT == 3, "N is found as the only digit 0b011");
+    wildcard_guide guide = {code, 0};
+    for (int64_t N_lsbs = code & (code >> 1) & ~(code >> 2) & wildcard_digit_lsbs();  N_lsbs;  N_lsbs &= N_lsbs - 1) {
+        const int shift = __builtin_ctzll(N_lsbs);
+        guide.code &= ~(WILDCARD_DIGIT_MASK << shift);
+        guide.N_mask |= uint32_t(1) << (shift / bits_per_base);
+    }
+    return guide;
+}
+
+
+// The digits of a code under an N_mask.
+inline int64_t wildcard_digits(uint32_t N_mask) {
+    int64_t digits = 0;
+    for (;  N_mask;  N_mask &= N_mask - 1) {
+        digits |= WILDCARD_DIGIT_MASK << (bits_per_base * __builtin_ctz(N_mask));
+    }
+    return digits;
+}
+
+
+class wildcard_table {
+public:
+    wildcard_table() {}
+
+    // Sort and deduplicate guides into a table.
+    explicit wildcard_table(std::vector<wildcard_guide> guides, int num_threads = 1) {
+        // by code, then stably by N_mask
+        radix_sort(guides, [](const wildcard_guide& g) { return (uint64_t) g.code; },
+                   bits_per_base * WILDCARD_DIGITS, num_threads);
+        radix_sort(guides, [](const wildcard_guide& g) { return (uint64_t) g.N_mask; },
+                   WILDCARD_DIGITS, num_threads);
+        guides.erase(std::unique(guides.begin(), guides.end(),
+                                 [](const wildcard_guide& a, const wildcard_guide& b) {
+                                     return a.code == b.code && a.N_mask == b.N_mask;
+                                 }),
+                     guides.end());
+        records.swap(guides);
+
+        for (size_t i = 0;  i < records.size(); ) {
+            size_t j = i;
+            while (j < records.size() && records[j].N_mask == records[i].N_mask) {
+                ++j;
+            }
+            masks.push_back(mask_run{records[i].N_mask, wildcard_digits(records[i].N_mask), i, j});
+            i = j;
+        }
+    }
+
+    size_t size() const { return records.size(); }
+    const std::vector<wildcard_guide>& guides() const { return records; }
+
+    // Whether the concrete guide code (without N digits) is a variant of
+    // any wildcard guide in the table.
+    bool covers(int64_t code) const {
+        for (auto it = masks.begin();  it != masks.end();  ++it) {
+            const int64_t key = code & ~it->digits;
+            const auto first = records.begin() + it->begin;
+            const auto last = records.begin() + it->end;
+            const auto found = std::lower_bound(first, last, key,
+                                                [](const wildcard_guide& g, int64_t c) { return g.code < c; });
+            if (found != last && found->code == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Call f(code) for every variant of every wildcard guide, in
+    // increasing order.  Variants of different guides may coincide, and
+    // then come once per guide.
+    //
+    // Counting n_code up gives each guide's variants in increasing order,
+    // so the guides are merged through a heap of cursors.  A guide joins
+    // the heap only once the merge reaches its first variant, and leaves
+    // after its last, so the heap holds just the guides whose variants
+    // straddle the merge, and nothing holds the variants themselves.
+    template <typename F>
+    void for_each_variant(F f) const {
+        std::vector<variant_cursor> waiting;
+        waiting.reserve(records.size());
+        for (auto it = records.begin();  it != records.end();  ++it) {
+            waiting.push_back(variant_cursor{variant(*it, 0), *it, 0});
+        }
+        const auto earlier = [](const variant_cursor& a, const variant_cursor& b) { return a.code < b.code; };
+        const auto later = [](const variant_cursor& a, const variant_cursor& b) { return a.code > b.code; };
+        std::sort(waiting.begin(), waiting.end(), earlier);
+
+        std::vector<variant_cursor> heap;
+        auto next = waiting.begin();
+        while (true) {
+            while (next != waiting.end() && (heap.empty() || next->code <= heap.front().code)) {
+                heap.push_back(*next++);
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+            if (heap.empty()) {
+                break;
+            }
+            std::pop_heap(heap.begin(), heap.end(), later);
+            variant_cursor& c = heap.back();
+            // the guide's variants up to the next variant of another guide
+            // need no heap operations
+            const int64_t bound = std::min(heap.size() > 1 ? heap.front().code : INT64_MAX,
+                                           next != waiting.end() ? next->code : INT64_MAX);
+            const uint32_t number_variants = uint32_t(1) << (2 * __builtin_popcount(c.guide.N_mask));
+            do {
+                f(c.code);
+            } while (++c.n_code < number_variants && (c.code = variant(c.guide, c.n_code)) <= bound);
+            if (c.n_code < number_variants) {
+                std::push_heap(heap.begin(), heap.end(), later);
+            } else {
+                heap.pop_back();
+            }
+        }
+    }
+
+private:
+    struct mask_run {
+        uint32_t N_mask;
+        int64_t digits;       // the digits N_mask covers
+        size_t begin;         // records[begin ... end) have this N_mask
+        size_t end;
+    };
+
+    // the next variant of guide to call f with
+    struct variant_cursor {
+        int64_t code;
+        wildcard_guide guide;
+        uint32_t n_code;
+    };
+
+    // The variant of guide with the bases of n_code, 2 bits each from the
+    // lowest, in place of its N digits from the lowest.
+    static int64_t variant(const wildcard_guide& guide, uint32_t n_code) {
+        // A, C, G, T
+        constexpr int64_t bases[] = {1, 2, 4, 5};
+        int64_t code = guide.code;
+        for (uint32_t m = guide.N_mask;  m;  m &= m - 1, n_code >>= 2) {
+            code |= bases[n_code & 3] << (bits_per_base * __builtin_ctz(m));
+        }
+        return code;
+    }
+
+    std::vector<wildcard_guide> records;
+    std::vector<mask_run> masks;
+};
+
+#endif